@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mem.h"
+#include "cpu.h"
+#include "uop.h"
+#include "jit.h"
+
+#define MEM_SIZE 0x10000
+#define CYCLES 400000000L  // 200 seconds of 8080 time
+#define CYCLES_PER_CALL 16667  // Half a frame, like emu_run_frame()
+
+#if defined(BENCH_JIT)
+#define DISPATCH "jit"
+#elif defined(BENCH_UOP)
+#define DISPATCH "uop"
+#elif defined(CPU_DISPATCH_SWITCH)
+#define DISPATCH "switch"
+#elif defined(CPU_DISPATCH_TABLE)
+#define DISPATCH "table"
+#else
+#define DISPATCH "goto"
+#endif
+
+
+// Synthetic workload: walk a buffer adding to every byte, with a subroutine
+// call, a compare and a conditional return in the inner loop. It only uses
+// instructions that the Space Invaders ROM uses too.
+static const uint8_t program[] = {
+    0x31, 0x00, 0x24,   // 0000 LXI SP, 2400
+    0x21, 0x00, 0x20,   // 0003 LXI H, 2000
+    0x0e, 0x00,         // 0006 MVI C, 00
+    0x06, 0x03,         // 0008 MVI B, 03
+    0x7e,               // 000a MOV A, M
+    0x80,               // 000b ADD B
+    0x77,               // 000c MOV M, A
+    0x23,               // 000d INX H
+    0xcd, 0x20, 0x00,   // 000e CALL 0020
+    0x0d,               // 0011 DCR C
+    0xc2, 0x0a, 0x00,   // 0012 JNZ 000a
+    0xc3, 0x03, 0x00,   // 0015 JMP 0003
+};
+
+static const uint8_t subroutine[] = {
+    0xe6, 0x0f,         // 0020 ANI 0f
+    0xfe, 0x08,         // 0022 CPI 08
+    0xd8,               // 0024 RC
+    0xaf,               // 0025 XRA A
+    0xc9,               // 0026 RET
+};
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main() {
+    struct cpu cpu = {0};
+    cpu.mem = mem_new(MEM_SIZE);
+    mem_reset(cpu.mem);
+    mem_load(cpu.mem, 0x0000, program, sizeof program);
+    mem_load(cpu.mem, 0x0020, subroutine, sizeof subroutine);
+
+#ifdef BENCH_JIT
+    jit_t *jit = jit_new(&cpu);
+    if (!jit) {
+        puts("jit     not available on this host");
+        return 0;
+    }
+#define RUN(cycles) jit_run(jit, cycles)
+#elif defined(BENCH_UOP)
+    uop_cache_t *uop = uop_new(&cpu);
+#define RUN(cycles) uop_run(uop, cycles)
+#else
+#define RUN(cycles) cpu_run(&cpu, cycles)
+#endif
+
+    double start = now();
+
+    long cycles = 0;
+    while (cycles < CYCLES) {
+        long c = RUN(CYCLES_PER_CALL);
+        if (c < 0) {
+            printf("Unimplemented instruction 0x%02x\n", cpu.ir);
+            return 1;
+        }
+        cycles += c;
+    }
+
+    double elapsed = now() - start;
+
+    printf("%-6s  %8.2f MIPS  %8.2f MHz  (%llu instructions in %.3f s)\n",
+            DISPATCH,
+            cpu.instructions / elapsed / 1e6,
+            cycles / elapsed / 1e6,
+            (unsigned long long) cpu.instructions, elapsed);
+
+    return 0;
+}
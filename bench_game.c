@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "emu.h"
+#include "movie.h"
+
+#define BOOT_FRAMES 600      // Power on to the attract screens
+#define ATTRACT_FRAMES 3600  // A minute of the attract loop
+#define GAME_FRAMES 3600     // A minute of play
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+
+// Built-in game: insert a coin, start, then sweep left and right firing
+static movie_t *default_movie() {
+    movie_t *movie = movie_new();
+
+    for (long frame = 0; frame < GAME_FRAMES; frame++) {
+        uint8_t port1 = 0;
+        if (frame >= 60 && frame < 70) {
+            port1 |= 1;  // Coin
+        } else if (frame >= 120 && frame < 130) {
+            port1 |= 1 << 2;  // P1 start
+        } else if (frame >= 180) {
+            port1 |= (frame / 90) % 2 ? 1 << 5 : 1 << 6;  // Left, right
+            port1 |= (frame / 8) % 2 ? 1 << 4 : 0;  // Fire
+        }
+        movie_record(movie, frame, port1, 0);
+    }
+
+    return movie;
+}
+
+
+// Run frames from the current state, one JSON line of results
+static int run(emu_t *emu, const char *workload, const char *engine,
+               long frames, const movie_t *movie) {
+    double *times = malloc(frames * sizeof(double));
+    uint64_t instructions = emu->cpu.instructions;
+    uint64_t cycles = emu->sched.now;
+    long first = emu->frame;
+
+    double start = now();
+    for (long i = 0; i < frames; i++) {
+        if (movie) {
+            movie_input(movie, emu->frame - first, &emu->ports[1], &emu->ports[2]);
+        }
+
+        double t = now();
+        if (emu_run_frame(emu) < 0) {
+            printf("Unimplemented instruction in %s: ", workload);
+            emu_dump(emu);
+            return -1;
+        }
+        times[i] = now() - t;
+    }
+    double elapsed = now() - start;
+
+    instructions = emu->cpu.instructions - instructions;
+    cycles = emu->sched.now - cycles;
+    qsort(times, frames, sizeof(double), compare_double);
+
+    printf("{\"workload\": \"%s\", \"engine\": \"%s\", \"frames\": %ld, "
+           "\"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.2f, "
+           "\"ns_per_instruction\": %.3f, \"mhz\": %.2f, \"fps\": %.1f, "
+           "\"p50_us\": %.2f, \"p99_us\": %.2f}\n",
+            workload, engine, frames, (unsigned long long) instructions, elapsed,
+            instructions / elapsed / 1e6,
+            elapsed * 1e9 / instructions,
+            cycles / elapsed / 1e6,
+            frames / elapsed,
+            times[frames / 2] * 1e6,
+            times[frames * 99 / 100] * 1e6);
+
+    free(times);
+    return 0;
+}
+
+
+static void usage(const char *name) {
+    printf("Usage: %s [-e engine] [-m movie] [rom]\n", name);
+    puts("");
+    puts("Runs the boot, attract and game workloads uncapped and prints one");
+    puts("JSON line of results for each. The game is a built-in sequence of");
+    puts("inputs unless a movie recorded with invaders -r is given.");
+    puts("Engines: interp (default), uop, jit, all.");
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *rom = "invaders.rom";
+    const char *movie_name = NULL;
+    const char *engines[] = { "interp", "uop", "jit" };
+    int first = 0, last = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:m:h")) != -1) {
+        switch (opt) {
+            case 'e':
+                if (!strcmp(optarg, "all")) {
+                    first = 0;
+                    last = 2;
+                    break;
+                }
+                first = last = -1;
+                for (int i = 0; i < 3; i++) {
+                    if (!strcmp(optarg, engines[i])) {
+                        first = last = i;
+                    }
+                }
+                if (first < 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'm': movie_name = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        rom = argv[optind];
+    }
+
+    movie_t *movie = movie_name ? movie_load(movie_name) : default_movie();
+    if (!movie) {
+        printf("Could not load movie: %s\n", movie_name);
+        return 1;
+    }
+
+    for (int e = first; e <= last; e++) {
+        emu_t *emu = emu_new();
+        emu_load_rom(emu, rom);
+        if (!emu_set_engine(emu, (engine_t) e)) {
+            emu_free(emu);
+            continue;  // No JIT on this host
+        }
+
+        // Game from power on, boot then attract from the same machine
+        emu_t *game = emu_new();
+        emu_load_rom(game, rom);
+        emu_set_engine(game, (engine_t) e);
+
+        if (run(emu, "boot", engines[e], BOOT_FRAMES, NULL) ||
+                run(emu, "attract", engines[e], ATTRACT_FRAMES, NULL) ||
+                run(game, "game", engines[e], movie->count, movie)) {
+            return 1;
+        }
+
+        emu_free(emu);
+        emu_free(game);
+    }
+
+    movie_free(movie);
+    return 0;
+}
@@ -0,0 +1,228 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "emu.h"
+#include "video.h"
+
+#define FRAMES 20000
+#define PITCH (WIDTH + 8)  // Padded like a texture row may be, for the checks
+#define SCALED_PITCH (WIDTH * VIDEO_MAX_SCALE + 8)
+#define SCALED_SIZE (SCALED_PITCH * HEIGHT * VIDEO_MAX_SCALE)
+#define VRAM_SIZE (VRAM_END - VRAM_START)
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// The bit loop draw_video_ram() used before the expanders, kept as the
+// reference they are checked against. It wrote rows 1 to HEIGHT, one past
+// the end of the surface, so it gets a spare row here and the expanders,
+// which write rows 0 to HEIGHT - 1, must match it one row down.
+static void baseline(const uint8_t *vram, uint32_t *pix) {
+    int i = 0;
+    for (int col = 0; col < WIDTH; col ++) {
+        for (int row = HEIGHT; row > 0; row -= 8) {
+            for (int j = 0; j < 8; j++) {
+                int idx = (row - j) * WIDTH + col;
+
+                if (vram[i] & 1 << j) {
+                    pix[idx] = 0xFFFFFF;
+                } else {
+                    pix[idx] = 0x000000;
+                }
+            }
+
+            i++;
+        }
+    }
+}
+
+// Whether pix, rows PITCH pixels apart, matches the baseline and left the
+// padding alone
+static int same_as_baseline(const uint32_t *pix, const uint32_t *expected) {
+    for (int row = 0; row < HEIGHT; row++) {
+        if (memcmp(&pix[row * PITCH], &expected[(row + 1) * WIDTH], WIDTH * sizeof(uint32_t))) {
+            return 0;
+        }
+        for (int col = WIDTH; col < PITCH; col++) {
+            if (pix[row * PITCH + col] != 0xaaaaaaaa) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+// Nearest neighbour stretch by 16.16 fixed point steps, the way SDL scales
+// blits in software, as the baseline for the upscalers
+static void stretch(const uint32_t *pix, uint32_t *out, int w, int h) {
+    uint32_t xstep = (WIDTH << 16) / w;
+    uint32_t ystep = (HEIGHT << 16) / h;
+
+    for (int y = 0; y < h; y++) {
+        const uint32_t *src = &pix[(y * ystep >> 16) * WIDTH];
+        uint32_t sx = 0;
+        for (int x = 0; x < w; x++, sx += xstep) {
+            out[y * w + x] = src[sx >> 16];
+        }
+    }
+}
+
+
+// Upscale a random frame with every upscaler at every scale, check they all
+// agree with the scalar one, then time them against a plain stretch
+static int bench_upscalers(const uint32_t *pix) {
+    static uint32_t expected[SCALED_SIZE];
+    static uint32_t out[SCALED_SIZE];
+    static uint32_t mask[HEIGHT * VIDEO_MAX_SCALE];
+
+    int n;
+    const video_upscaler_t *upscalers = video_upscalers(&n);
+
+    for (int scale = 1; scale <= VIDEO_MAX_SCALE; scale++) {
+        video_row_masks(mask, scale, 1, 1);
+
+        memset(expected, 0xaa, sizeof expected);
+        upscalers[0].upscale(pix, expected, SCALED_PITCH, scale, mask, HEIGHT);
+        for (int u = 1; u < n; u++) {
+            memset(out, 0xaa, sizeof out);
+            upscalers[u].upscale(pix, out, SCALED_PITCH, scale, mask, HEIGHT);
+            if (memcmp(out, expected, sizeof out)) {
+                printf("%-6s  %dx differs from scalar\n", upscalers[u].name, scale);
+                return 1;
+            }
+        }
+    }
+
+    for (int scale = 2; scale <= VIDEO_MAX_SCALE; scale++) {
+        video_row_masks(mask, scale, 1, 1);
+        int w = WIDTH * scale, h = HEIGHT * scale;
+
+        double start = now();
+        for (int frame = 0; frame < FRAMES / 10; frame++) {
+            stretch(pix, out, w, h);
+        }
+        double elapsed = now() - start;
+        printf("%dx stretch  %8.0f frames/s  %8.2f Mpixels/s\n", scale,
+                FRAMES / 10 / elapsed, FRAMES / 10 / elapsed * w * h / 1e6);
+
+        for (int u = 0; u < n; u++) {
+            start = now();
+            for (int frame = 0; frame < FRAMES / 10; frame++) {
+                upscalers[u].upscale(pix, out, w, scale, mask, HEIGHT);
+            }
+            elapsed = now() - start;
+            printf("%dx %-7s %8.0f frames/s  %8.2f Mpixels/s\n", scale,
+                    upscalers[u].name,
+                    FRAMES / 10 / elapsed, FRAMES / 10 / elapsed * w * h / 1e6);
+        }
+    }
+
+    return 0;
+}
+
+
+// Expand rows of next over a frame expanded from prev, for every band range
+// the redraw can ask for. Those rows must match next, the others either
+// frame, since large ranges redo the whole frame.
+static int check_expand_rows(const uint8_t *prev, const uint8_t *next) {
+    static uint32_t before[WIDTH * HEIGHT];
+    static uint32_t after[WIDTH * HEIGHT];
+    static uint32_t pix[WIDTH * HEIGHT];
+
+    video_expand(prev, before, WIDTH);
+    video_expand(next, after, WIDTH);
+
+    for (int top = 0; top < HEIGHT; top += 8) {
+        for (int bottom = top; bottom <= HEIGHT; bottom += 8) {
+            memcpy(pix, before, sizeof pix);
+            video_expand_rows(next, pix, WIDTH, top, bottom);
+
+            for (int row = 0; row < HEIGHT; row++) {
+                size_t n = WIDTH * sizeof(uint32_t);
+                int is_after = !memcmp(&pix[row * WIDTH], &after[row * WIDTH], n);
+                int is_before = !memcmp(&pix[row * WIDTH], &before[row * WIDTH], n);
+                if (row >= top && row < bottom ? !is_after : !is_after && !is_before) {
+                    printf("rows %d to %d  differ from a whole frame expansion\n", top, bottom);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+// Convert random frames with every expander, check they all agree with the
+// baseline loop, then time them, then the upscalers
+int main() {
+    static uint8_t vram[VRAM_SIZE];
+    static uint32_t expected[WIDTH * (HEIGHT + 1)];
+    static uint32_t pix[PITCH * HEIGHT];
+
+    video_init();
+
+    int n;
+    const video_expander_t *expanders = video_expanders(&n);
+
+    static uint8_t prev[VRAM_SIZE];
+    uint32_t seed = 1;
+    for (int frame = 0; frame < 16; frame++) {
+        memcpy(prev, vram, sizeof prev);
+        for (int i = 0; i < VRAM_SIZE; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            vram[i] = frame == 0 ? 0x00 : frame == 1 ? 0xff : seed;
+        }
+
+        baseline(vram, expected);
+        for (int e = 0; e < n; e++) {
+            memset(pix, 0xaa, sizeof pix);
+            expanders[e].expand(vram, pix, PITCH);
+            if (!same_as_baseline(pix, expected)) {
+                printf("%-6s  differs from the baseline loop\n", expanders[e].name);
+                return 1;
+            }
+        }
+        if (frame < 4 && check_expand_rows(prev, vram)) {
+            return 1;
+        }
+    }
+
+    for (int e = 0; e < n; e++) {
+        double start = now();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            vram[frame % VRAM_SIZE]++;
+            expanders[e].expand(vram, pix, WIDTH);
+        }
+        double elapsed = now() - start;
+
+        printf("%-6s  %8.0f frames/s  %8.2f Mpixels/s\n",
+                expanders[e].name,
+                FRAMES / elapsed,
+                FRAMES / elapsed * WIDTH * HEIGHT / 1e6);
+    }
+
+    // A redraw of the 16 rows the invaders step through
+    double start = now();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        vram[frame % VRAM_SIZE]++;
+        video_expand_rows(vram, pix, WIDTH, 64, 80);
+    }
+    double elapsed = now() - start;
+    printf("rows    %8.0f frames/s  %8.2f Mpixels/s  (16 rows)\n", FRAMES / elapsed,
+            FRAMES / elapsed * WIDTH * 16 / 1e6);
+
+    return bench_upscalers(pix);
+}
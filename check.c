@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu.h"
+
+/*
+ * Engine checks
+ *
+ * Runs the same machine on the interpreter and on each other engine and
+ * compares whole snapshots at every frame boundary: registers, master cycle
+ * counter, scheduled events and RAM. Engines must agree with the interpreter
+ * to the cycle, or interrupts are taken at other points and movies and
+ * snapshots stop matching across engines. The programs are built in, and a
+ * ROM given on the command line is checked the same way.
+ */
+
+#define FRAMES 600        // Frames compared per program
+#define ROM_SIZE 0x2000
+
+static const char *engine_names[] = { "interp", "uop", "jit" };
+
+
+// Long straight blocks with interrupts on, so that any engine that runs
+// past the deadline takes them late. Both interrupt handlers count into RAM.
+static void long_blocks_rom(uint8_t *rom) {
+    static const uint8_t handler[] = {
+        0xf5,              // PUSH PSW
+        0xe5,              // PUSH H
+        0x21, 0x00, 0x20,  // LXI H, 2000 (2001 for RST 2)
+        0x34,              // INR M
+        0xe1,              // POP H
+        0xf1,              // POP PSW
+        0xfb,              // EI
+        0xc9,              // RET
+    };
+    static const uint8_t body[] = {
+        0x80,        // ADD B
+        0x04,        // INR B
+        0x77,        // MOV M, A
+        0x23,        // INX H
+        0x8a,        // ADC D
+        0x14,        // INR D
+        0x07,        // RLC
+        0x0d,        // DCR C
+        0xa9,        // XRA C
+        0xc6, 0x35,  // ADI 35
+    };
+
+    memset(rom, 0, ROM_SIZE);
+    memcpy(&rom[0x0000], (uint8_t[]) { 0xc3, 0x40, 0x00 }, 3);  // JMP 0040
+    memcpy(&rom[0x0008], handler, sizeof handler);
+    memcpy(&rom[0x0010], handler, sizeof handler);
+    rom[0x0013] = 0x01;
+
+    int pc = 0x0040;
+    memcpy(&rom[pc], (uint8_t[]) { 0x31, 0x00, 0x24, 0xfb }, 4);  // LXI SP, 2400; EI
+    pc += 4;
+    int loop = pc;
+    memcpy(&rom[pc], (uint8_t[]) { 0x21, 0x00, 0x21 }, 3);  // LXI H, 2100
+    pc += 3;
+    for (int i = 0; i < 6; i++) {
+        memcpy(&rom[pc], body, sizeof body);
+        pc += sizeof body;
+    }
+    memcpy(&rom[pc], (uint8_t[]) { 0xc3, loop & 0xff, loop >> 8 }, 3);  // JMP loop
+}
+
+
+// Code copied to RAM and patched through its mirrors between calls, both at
+// its own address and through a mirror, so that engines caching decoded or
+// translated code must see writes to every address of the same byte.
+static void mirror_patch_rom(uint8_t *rom) {
+    static const uint8_t program[] = {
+        0x31, 0x00, 0x24,  // LXI SP, 2400
+        0x21, 0x00, 0x21,  // LXI H, 2100
+        0x36, 0x3e,        // MVI M, 3E (MVI A, 00; RET at 2100)
+        0x23,              // INX H
+        0x36, 0x00,        // MVI M, 00
+        0x23,              // INX H
+        0x36, 0xc9,        // MVI M, C9
+        0x06, 0x00,        // MVI B, 00
+        0x04,              // loop: INR B
+        0x78,              // MOV A, B
+        0x32, 0x01, 0x61,  // STA 6101
+        0xcd, 0x00, 0x21,  // CALL 2100
+        0x32, 0x02, 0x20,  // STA 2002
+        0x3c,              // INR A
+        0x32, 0x01, 0xa1,  // STA A101
+        0xcd, 0x00, 0x61,  // CALL 6100
+        0x32, 0x03, 0x20,  // STA 2003
+        0xc3, 0x50, 0x00,  // JMP loop
+    };
+
+    memset(rom, 0, ROM_SIZE);
+    memcpy(&rom[0x0000], (uint8_t[]) { 0xc3, 0x40, 0x00 }, 3);  // JMP 0040
+    memcpy(&rom[0x0040], program, sizeof program);
+}
+
+
+// Run frames of the ROM on the interpreter and on engine, comparing the two
+// machines after each. Returns 1 if they differ, 0 otherwise, also when the
+// engine is not available here.
+static int compare_frames(const char *name, const uint8_t *rom, engine_t engine) {
+    emu_t *ref = emu_new();
+    emu_t *test = emu_new();
+    mem_load(ref->cpu.mem, 0, rom, ROM_SIZE);
+    mem_load(test->cpu.mem, 0, rom, ROM_SIZE);
+    if (!emu_set_engine(test, engine)) {
+        emu_free(ref);
+        emu_free(test);
+        return 0;
+    }
+
+    size_t size = emu_state_size(ref);
+    uint8_t *ref_state = malloc(size);
+    uint8_t *test_state = malloc(size);
+    int result = 0;
+
+    for (int frame = 0; frame < FRAMES && !result; frame++) {
+        if (emu_run_frame(ref) < 0 || emu_run_frame(test) < 0) {
+            printf("%s, %s: unimplemented instruction in frame %d\n", name,
+                    engine_names[engine], frame);
+            result = 1;
+            break;
+        }
+
+        emu_save(ref, ref_state);
+        emu_save(test, test_state);
+        if (memcmp(ref_state, test_state, size)) {
+            printf("%s, %s: differs from the interpreter at the end of frame %d "
+                   "(PC %04x, interpreter %04x)\n", name, engine_names[engine], frame,
+                    test->cpu.pc, ref->cpu.pc);
+            result = 1;
+        }
+    }
+
+    free(ref_state);
+    free(test_state);
+    emu_free(ref);
+    emu_free(test);
+    return result;
+}
+
+static int check_engines(const char *name, const uint8_t *rom) {
+    int failed = 0;
+    for (engine_t e = ENGINE_UOP; e <= ENGINE_JIT; e++) {
+        failed |= compare_frames(name, rom, e);
+    }
+
+    printf("%-12s %s\n", name, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+
+int main(int argc, char *argv[]) {
+    static uint8_t rom[ROM_SIZE];
+    int failed = 0;
+
+    long_blocks_rom(rom);
+    failed |= check_engines("long blocks", rom);
+    mirror_patch_rom(rom);
+    failed |= check_engines("mirror patch", rom);
+
+    if (argc > 1) {
+        FILE *f = fopen(argv[1], "rb");
+        if (!f) {
+            printf("Could not open ROM: %s\n", argv[1]);
+            return 1;
+        }
+        memset(rom, 0, sizeof rom);
+        fread(rom, 1, sizeof rom, f);
+        fclose(f);
+        failed |= check_engines(argv[1], rom);
+    }
+
+    return failed;
+}
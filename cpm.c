@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "mem.h"
+#include "uop.h"
+#include "jit.h"
+#include "disassembler.h"
+
+/*
+ * CP/M test harness
+ *
+ * Runs 8080 CP/M programs (.COM files) such as the TST8080, 8080PRE, CPUTEST
+ * and 8080EXM CPU tests on a bare CPU with 64K of RAM. Programs are loaded at
+ * TPA and only get a console: the BDOS entry at 0x0005 jumps to a stub that
+ * hands the call to the harness with an OUT, and the warm boot at 0x0000
+ * ends the program the same way.
+ */
+
+#define TPA 0x0100   // Where programs are loaded and started
+#define BDOS 0xfe00  // BDOS stub, also the top of memory programs see
+#define SLICE 100000 // Cycles run between checks for the end of the program
+
+#define PORT_BOOT 0  // OUT from the warm boot at 0x0000
+#define PORT_BDOS 1  // OUT from the BDOS stub
+
+static int done;
+
+
+static uint8_t port_in(struct cpu *cpu, uint8_t port) {
+    return 0;
+}
+
+// Console functions 2 (print the character in E) and 9 (print the string at
+// DE, up to a '$'). Anything else is ignored.
+static void bdos(struct cpu *cpu) {
+    switch (cpu->c) {
+        case 2:
+            putchar(cpu->e);
+            break;
+        case 9:
+            for (uint16_t addr = cpu->de; mem_read(cpu->mem, addr) != '$'; addr++) {
+                putchar(mem_read(cpu->mem, addr));
+            }
+            break;
+    }
+    fflush(stdout);
+}
+
+static void port_out_ignored(struct cpu *cpu, uint8_t port, uint8_t value) {
+}
+
+static void port_out(struct cpu *cpu, uint8_t port, uint8_t value) {
+    switch (port) {
+        case PORT_BOOT:
+            done = 1;
+            break;
+        case PORT_BDOS:
+            bdos(cpu);
+            break;
+    }
+}
+
+
+// Check that the cycles in the opcode table the translators and tools go by
+// (see disassembler.c) agree with the interpreter, with the condition of
+// conditional instructions failing and holding. Each opcode
+// runs once with all flags clear and once with all set, so each condition
+// goes both ways. Returns the number of differences.
+static int check_opcode_table() {
+    mem_t *mem = mem_new(0x10000);
+    int differences = 0;
+
+    for (int op = 0; op < 256; op++) {
+        const disasm_op_t *d = &disasm_ops[op];
+
+        for (int set = 0; set < 2; set++) {
+            mem_reset(mem);
+            const uint8_t code[] = { op, 0x34, 0x12 };
+            mem_load(mem, TPA, code, sizeof code);
+
+            struct cpu cpu = { 0 };
+            cpu.mem = mem;
+            cpu.in = port_in;
+            cpu.out = port_out_ignored;
+            cpu.pc = TPA;
+            cpu.sp = BDOS;
+            cpu.f = set ? F_ALL : 0;
+
+            cpu_fetch(&cpu);
+            int cycles = cpu_run_instruction(&cpu);
+
+            // Bit 3 of a condition code says whether it tests for a flag set
+            int conditional = d->cycles != d->cycles_taken;
+            int holds = conditional && (op >> 3 & 1) == set;
+            int expected = holds ? d->cycles_taken : d->cycles;
+            if (cycles != expected) {
+                printf("Opcode %02x: %d cycles in the table, %d in the CPU\n", op, expected, cycles);
+                differences++;
+            }
+        }
+    }
+
+    mem_free(mem);
+    return differences;
+}
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Run a program to its warm boot. Returns -1 if it could not be loaded or
+// hit an unimplemented instruction.
+static int run(const char *file_name, const char *engine) {
+    FILE *f = fopen(file_name, "rb");
+    if (!f) {
+        printf("Could not open program: %s\n", file_name);
+        return -1;
+    }
+
+    static uint8_t program[BDOS - TPA];
+    size_t size = fread(program, 1, BDOS - TPA, f);
+    fclose(f);
+
+    mem_t *mem = mem_new(0x10000);
+    mem_reset(mem);
+    mem_load(mem, TPA, program, size);
+
+    const uint8_t boot[] = { 0xd3, PORT_BOOT, 0x76 };          // OUT 0; HLT
+    const uint8_t entry[] = { 0xc3, BDOS & 0xff, BDOS >> 8 };  // JMP BDOS
+    const uint8_t stub[] = { 0xd3, PORT_BDOS, 0xc9 };          // OUT 1; RET
+    mem_load(mem, 0x0000, boot, sizeof boot);
+    mem_load(mem, 0x0005, entry, sizeof entry);
+    mem_load(mem, BDOS, stub, sizeof stub);
+
+    struct cpu cpu = { 0 };
+    cpu.mem = mem;
+    cpu.in = port_in;
+    cpu.out = port_out;
+    cpu.pc = TPA;
+    cpu.sp = BDOS;
+
+    uop_cache_t *uop = !strcmp(engine, "uop") ? uop_new(&cpu) : NULL;
+    jit_t *jit = !strcmp(engine, "jit") ? jit_new(&cpu) : NULL;
+
+    uint64_t cycles = 0;
+    double start = now();
+
+    done = 0;
+    while (!done) {
+        long c = jit ? jit_run(jit, SLICE) : uop ? uop_run(uop, SLICE) : cpu_run(&cpu, SLICE);
+        if (c < 0) {
+            printf("\nUnimplemented instruction:\n");
+            cpu_dump(&cpu);
+            return -1;
+        }
+        cycles += c;
+    }
+
+    double elapsed = now() - start;
+    fprintf(stderr, "\n%s: %llu instructions, %llu cycles in %.2f s (%.1f MIPS, %.1f MHz)\n",
+            file_name, (unsigned long long) cpu.instructions, (unsigned long long) cycles,
+            elapsed, cpu.instructions / elapsed / 1e6, cycles / elapsed / 1e6);
+
+    if (jit) {
+        jit_free(jit);
+    }
+    if (uop) {
+        uop_free(uop);
+    }
+    mem_free(mem);
+    return 0;
+}
+
+
+static void usage(const char *name) {
+    printf("Usage: %s [-e engine] program...\n", name);
+    puts("");
+    puts("Runs CP/M programs, such as the TST8080, 8080PRE, CPUTEST and");
+    puts("8080EXM CPU tests, with only the BDOS console functions. Their");
+    puts("output goes to stdout, the speed of each run to stderr.");
+    puts("Engines: interp (default), uop, jit.");
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *engine = "interp";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:h")) != -1) {
+        switch (opt) {
+            case 'e':
+                if (strcmp(optarg, "interp") && strcmp(optarg, "uop") && strcmp(optarg, "jit")) {
+                    usage(argv[0]);
+                }
+                engine = optarg;
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+    }
+
+    if (check_opcode_table()) {
+        puts("The opcode table and the CPU disagree, see disassembler.c");
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (run(argv[i], engine) < 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
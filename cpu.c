@@ -4,8 +4,52 @@
 #include <string.h>
 
 #include "cpu.h"
+#include "disassembler.h"
 
-struct cpu cpu; // Global
+/*
+ * Flags
+ *
+ * Zero, sign and parity only depend on the 8-bit result, and the carry is bit
+ * 8 of the 9-bit result, so all four come out of a single table lookup. Only
+ * the auxiliary carry is computed, from the carry into bit 4.
+ */
+
+// Parity is even when the result has an even number of bits set
+#define ODD_PARITY(n) ((0x6996 >> (((n) ^ ((n) >> 4)) & 0xf)) & 1)
+
+#define ZSPC(n) ( \
+        (((n) & 0xff) == 0 ? f_z : 0) | \
+        ((n) & 0x80 ? f_s : 0) | \
+        (ODD_PARITY((n) & 0xff) ? 0 : f_p) | \
+        ((n) & 0x100 ? f_cy : 0))
+
+#define INR_FLAGS(n) (ZSPC(n) | (((n) & 0xf) == 0x0 ? f_ac : 0))
+#define DCR_FLAGS(n) (ZSPC(n) | (((n) & 0xf) == 0xf ? 0 : f_ac))
+
+#define TABLE4(F, n)   F(n), F((n) + 1), F((n) + 2), F((n) + 3)
+#define TABLE16(F, n)  TABLE4(F, n), TABLE4(F, (n) + 4), TABLE4(F, (n) + 8), TABLE4(F, (n) + 12)
+#define TABLE64(F, n)  TABLE16(F, n), TABLE16(F, (n) + 16), TABLE16(F, (n) + 32), TABLE16(F, (n) + 48)
+#define TABLE256(F, n) TABLE64(F, n), TABLE64(F, (n) + 64), TABLE64(F, (n) + 128), TABLE64(F, (n) + 192)
+
+// Indexed by 8-bit result
+static const uint8_t zsp_table[256] = { TABLE256(ZSPC, 0) };
+static const uint8_t inr_table[256] = { TABLE256(INR_FLAGS, 0) };
+static const uint8_t dcr_table[256] = { TABLE256(DCR_FLAGS, 0) };
+
+// Indexed by 9-bit result, bit 8 being the carry (or borrow)
+static const uint8_t zspc_table[512] = { TABLE256(ZSPC, 0), TABLE256(ZSPC, 256) };
+
+// All flags for result = a + value (+ carry)
+#define ADD_FLAGS(a, value, result) \
+    (zspc_table[(result) & 0x1ff] | (((a) ^ (value) ^ (result)) & f_ac))
+
+// All flags for result = a - value (- borrow). The 8080 subtracts by adding
+// the complement, so AC is the carry out of that addition.
+#define SUB_FLAGS(a, value, result) \
+    (zspc_table[(result) & 0x1ff] | (~((a) ^ (value) ^ (result)) & f_ac))
+
+// AND sets AC to the OR of bit 3 of both operands
+#define ANA_AC(a, value) ((((a) | (value)) & 0x08) << 1)
 
 
 /*
@@ -13,123 +57,109 @@ struct cpu cpu; // Global
  */
 
 // MOV r1, r2 (Move register to register)
-static int MOV(uint8_t *dest, const uint8_t *src) {
+static int MOV(struct cpu *cpu, uint8_t *dest, const uint8_t *src) {
     *dest = *src;
 
     return 5;
 }
 
 // MOV r, M (Move memory to register)
-static int MOV_from_mem(uint8_t *src) {
-    *src = mem_read(cpu.mem, cpu.hl);
+static int MOV_from_mem(struct cpu *cpu, uint8_t *src) {
+    *src = mem_read(cpu->mem, cpu->hl);
 
     return 7;
 }
 
 // MOV M, r (Move register to memory)
-static int MOV_to_mem(const uint8_t *src) {
-    mem_write(cpu.mem, cpu.hl, *src);
+static int MOV_to_mem(struct cpu *cpu, const uint8_t *src) {
+    mem_write(cpu->mem, cpu->hl, *src);
 
     return 7;
 }
 
 // MVI r, D8 (Move immediate register)
-static int MVI(uint8_t *dest) {
-    cpu_read_byte_to_z();
-
-    *dest = cpu.z;
+static int MVI(struct cpu *cpu, uint8_t *dest) {
+    *dest = cpu->z;
 
     return 7;
 }
 
 // MVI M, D8 (Move to memory immediate)
-static int MVI_to_mem() {
-    cpu_read_byte_to_z();
-
-    mem_write(cpu.mem, cpu.hl, cpu.z);
+static int MVI_to_mem(struct cpu *cpu) {
+    mem_write(cpu->mem, cpu->hl, cpu->z);
 
     return 10;
 }
 
 // LXI rp, D16 (Load register pair immediate)
-static int LXI(uint16_t *dest) {
-    cpu_read_bytes_to_wz();
-
-    *dest = cpu.wz;
+static int LXI(struct cpu *cpu, uint16_t *dest) {
+    *dest = cpu->wz;
 
     return 10;
 }
 
 // LDA addr (Load accumulator direct)
-static int LDA() {
-    cpu_read_bytes_to_wz();
-
-    cpu.a = mem_read(cpu.mem, cpu.wz);
+static int LDA(struct cpu *cpu) {
+    cpu->a = mem_read(cpu->mem, cpu->wz);
 
     return 13;
 }
 
 // STA addr (Store Accumulator direct)
-static int STA() {
-    cpu_read_bytes_to_wz();
-
-    mem_write(cpu.mem, cpu.wz, cpu.a);
+static int STA(struct cpu *cpu) {
+    mem_write(cpu->mem, cpu->wz, cpu->a);
 
     return 13;
 }
 
 // LHLD addr (Load H and L direct)
-static int LHLD() {
-    cpu_read_bytes_to_wz();
-
-    cpu.h =  mem_read(cpu.mem, cpu.wz+1);
-    cpu.l =  mem_read(cpu.mem, cpu.wz);
+static int LHLD(struct cpu *cpu) {
+    cpu->h =  mem_read(cpu->mem, cpu->wz+1);
+    cpu->l =  mem_read(cpu->mem, cpu->wz);
 
     return 16;
 }
 
 // SHLD addr (Store H and L direct)
-static int SHLD() {
-    cpu_read_bytes_to_wz();
-
-    mem_write(cpu.mem, cpu.wz+1, cpu.h);
-    mem_write(cpu.mem, cpu.wz, cpu.l);
+static int SHLD(struct cpu *cpu) {
+    mem_write(cpu->mem, cpu->wz+1, cpu->h);
+    mem_write(cpu->mem, cpu->wz, cpu->l);
 
     return 16;
 }
 
 // LDAX B (Load accumulator indirect)
-static int LDAX_B() {
-    cpu.a = mem_read(cpu.mem, cpu.bc);
+static int LDAX_B(struct cpu *cpu) {
+    cpu->a = mem_read(cpu->mem, cpu->bc);
 
     return 7;
 }
 
 // LDAX D (Load accumulator indirect)
-static int LDAX_D() {
-    cpu.a = mem_read(cpu.mem, cpu.de);
+static int LDAX_D(struct cpu *cpu) {
+    cpu->a = mem_read(cpu->mem, cpu->de);
 
     return 7;
 }
 
 // STAX B (Store accumulator indirect)
-static int STAX_B() {
-    mem_write(cpu.mem, cpu.bc, cpu.a);
+static int STAX_B(struct cpu *cpu) {
+    mem_write(cpu->mem, cpu->bc, cpu->a);
 
     return 7;
 }
 
 // STAX D (Store accumulator indirect)
-static int STAX_D() {
-    mem_write(cpu.mem, cpu.de, cpu.a);
+static int STAX_D(struct cpu *cpu) {
+    mem_write(cpu->mem, cpu->de, cpu->a);
 
     return 7;
 }
 
 // XCHG (Exchange H and L with D and E)
-static int XCHG() {
+static int XCHG(struct cpu *cpu) {
     // TODO Watch out!
-    cpu.hl ^= cpu.de; cpu.de ^= cpu.hl; cpu.hl ^= cpu.de;
+    cpu->hl ^= cpu->de; cpu->de ^= cpu->hl; cpu->hl ^= cpu->de;
 
     return 4;
 }
@@ -141,133 +171,192 @@ static int XCHG() {
  */
 
 // ADD r (Add Register)
-static int ADD(uint8_t *r) {
-    uint16_t result = cpu.a + *r;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ALL);
+static int ADD(struct cpu *cpu, uint8_t *r) {
+    uint16_t result = cpu->a + *r;
+    cpu->f = (cpu->f & ~F_ALL) | ADD_FLAGS(cpu->a, *r, result);
+    cpu->a = result;
 
     return 4;
 }
 
 // ADD M (Add memory)
-static int ADD_M() {
-    uint16_t result = cpu.a + mem_read(cpu.mem, cpu.hl);
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ALL);
+static int ADD_M(struct cpu *cpu) {
+    uint8_t value = mem_read(cpu->mem, cpu->hl);
+    uint16_t result = cpu->a + value;
+    cpu->f = (cpu->f & ~F_ALL) | ADD_FLAGS(cpu->a, value, result);
+    cpu->a = result;
 
     return 7;
 }
 
 // ADI D8 (Add immediate)
-static int ADI() {
-    cpu_read_byte_to_z();
-    uint16_t result = cpu.a + cpu.z;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ALL);
+static int ADI(struct cpu *cpu) {
+    uint16_t result = cpu->a + cpu->z;
+    cpu->f = (cpu->f & ~F_ALL) | ADD_FLAGS(cpu->a, cpu->z, result);
+    cpu->a = result;
 
     return 7;
 }
 
 // ADC r (Add Register with carry)
-static int ADC(uint8_t *r) {
-    uint16_t result = cpu.a + *r + cpu.flags.cy;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ALL);
+static int ADC(struct cpu *cpu, uint8_t *r) {
+    uint16_t result = cpu->a + *r + cpu->flags.cy;
+    cpu->f = (cpu->f & ~F_ALL) | ADD_FLAGS(cpu->a, *r, result);
+    cpu->a = result;
 
     return 4;
+}
 
+// ADC M (Add memory with carry)
+static int ADC_M(struct cpu *cpu) {
+    uint8_t value = mem_read(cpu->mem, cpu->hl);
+    uint16_t result = cpu->a + value + cpu->flags.cy;
+    cpu->f = (cpu->f & ~F_ALL) | ADD_FLAGS(cpu->a, value, result);
+    cpu->a = result;
+
+    return 7;
+}
+
+// ACI D8 (Add immediate with carry)
+static int ACI(struct cpu *cpu) {
+    uint16_t result = cpu->a + cpu->z + cpu->flags.cy;
+    cpu->f = (cpu->f & ~F_ALL) | ADD_FLAGS(cpu->a, cpu->z, result);
+    cpu->a = result;
+
+    return 7;
 }
 
 // SUB r (Subtract Register)
-static int SUB(uint8_t *r) {
-    uint16_t result = cpu.a - *r;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ALL);
+static int SUB(struct cpu *cpu, uint8_t *r) {
+    uint16_t result = cpu->a - *r;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, *r, result);
+    cpu->a = result;
 
     return 4;
 }
 
-// SUI D8 (Add immediate)
-static int SUI() {
-    cpu_read_byte_to_z();
-    uint16_t result = cpu.a - cpu.z;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ALL);
+// SUB M (Subtract memory)
+static int SUB_M(struct cpu *cpu) {
+    uint8_t value = mem_read(cpu->mem, cpu->hl);
+    uint16_t result = cpu->a - value;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, value, result);
+    cpu->a = result;
 
     return 7;
 }
 
-// Subtract immediate with borrow
-static int SBI() {
-    cpu_read_byte_to_z();
-    uint16_t result = cpu.a - cpu.z - cpu.flags.cy;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ALL);
+// SUI D8 (Subtract immediate)
+static int SUI(struct cpu *cpu) {
+    uint16_t result = cpu->a - cpu->z;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, cpu->z, result);
+    cpu->a = result;
+
+    return 7;
+}
+
+// SBB r (Subtract Register with borrow)
+static int SBB(struct cpu *cpu, uint8_t *r) {
+    uint16_t result = cpu->a - *r - cpu->flags.cy;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, *r, result);
+    cpu->a = result;
+
+    return 4;
+}
+
+// SBB M (Subtract memory with borrow)
+static int SBB_M(struct cpu *cpu) {
+    uint8_t value = mem_read(cpu->mem, cpu->hl);
+    uint16_t result = cpu->a - value - cpu->flags.cy;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, value, result);
+    cpu->a = result;
+
+    return 7;
+}
+
+// SBI D8 (Subtract immediate with borrow)
+static int SBI(struct cpu *cpu) {
+    uint16_t result = cpu->a - cpu->z - cpu->flags.cy;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, cpu->z, result);
+    cpu->a = result;
 
     return 7;
 }
 
 // INR r (Increment Register)
-static int INR(uint8_t *r) {
-    uint16_t result = *r + 1;
+static int INR(struct cpu *cpu, uint8_t *r) {
+    uint8_t result = *r + 1;
     *r = result;
-    cpu_handle_flags(result, 8, F_ZSP | f_ac);
+    cpu->f = (cpu->f & ~(F_ZSP | f_ac)) | inr_table[result];
 
     return 5;
 }
 
 // INR M (Increment memory)
-static int INR_M() {
-    uint32_t result = mem_read(cpu.mem, cpu.hl) + 1;
-    mem_write(cpu.mem, cpu.hl, result);
-    cpu_handle_flags(result, 16, F_ZSP | f_ac);
+static int INR_M(struct cpu *cpu) {
+    uint8_t result = mem_read(cpu->mem, cpu->hl) + 1;
+    mem_write(cpu->mem, cpu->hl, result);
+    cpu->f = (cpu->f & ~(F_ZSP | f_ac)) | inr_table[result];
 
     return 10;
 }
 
 // DCR r (Decrement Register)
-static int DCR(uint8_t *r) {
-    uint16_t result = *r - 1;
+static int DCR(struct cpu *cpu, uint8_t *r) {
+    uint8_t result = *r - 1;
     *r = result;
-    cpu_handle_flags(result, 8, F_ZSP | f_ac);
+    cpu->f = (cpu->f & ~(F_ZSP | f_ac)) | dcr_table[result];
     return 5;
 }
 
 // DCR M (Decrement memory)
-static int DCR_M() {
-    uint32_t result = mem_read(cpu.mem, cpu.hl) - 1;
-    mem_write(cpu.mem, cpu.hl, result);
-    cpu_handle_flags(result, 16, F_ZSP | f_ac);
+static int DCR_M(struct cpu *cpu) {
+    uint8_t result = mem_read(cpu->mem, cpu->hl) - 1;
+    mem_write(cpu->mem, cpu->hl, result);
+    cpu->f = (cpu->f & ~(F_ZSP | f_ac)) | dcr_table[result];
 
     return 10;
 }
 
 // INX rp (Increment register pair)
-static int INX(uint16_t *rp) {
+static int INX(struct cpu *cpu, uint16_t *rp) {
     (*rp)++;
 
     return 5;
 }
 
 // DCX rp (Decrement register pair)
-static int DCX(uint16_t *rp) {
+static int DCX(struct cpu *cpu, uint16_t *rp) {
     (*rp)--;
 
     return 5;
 }
 
 // DAD rp (Add register pair to HL)
-static int DAD(uint16_t *rp) {
-    uint32_t result = cpu.hl + *rp;
-    cpu.hl = result;
-    cpu_handle_flags(result, 16, f_cy);
+static int DAD(struct cpu *cpu, uint16_t *rp) {
+    uint32_t result = cpu->hl + *rp;
+    cpu->hl = result;
+    cpu->flags.cy = result >> 16;
 
     return 10;
 }
 
-// Decimal adjust accumulator
-static int DAA() {
-    // TODO
+// DAA (Decimal adjust accumulator)
+static int DAA(struct cpu *cpu) {
+    uint8_t correction = 0;
+    uint8_t carry = cpu->flags.cy;
+
+    // Low digit first, then the high digit as it will be after that
+    if ((cpu->a & 0xf) > 9 || cpu->flags.ac) {
+        correction |= 0x06;
+    }
+    if (cpu->a > 0x99 || carry) {
+        correction |= 0x60;
+        carry = 1;
+    }
+
+    uint16_t result = cpu->a + correction;
+    cpu->f = (cpu->f & ~F_ALL) | ADD_FLAGS(cpu->a, correction, result) | carry;
+    cpu->a = result;
 
     return 4;
 }
@@ -279,140 +368,165 @@ static int DAA() {
  */
 
 // ANA r (AND Register)
-static int ANA(uint8_t *r) {
-    uint8_t result = cpu.a & *r;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ZSP | f_ac);
-    cpu.flags.cy = 0;
+static int ANA(struct cpu *cpu, uint8_t *r) {
+    uint8_t result = cpu->a & *r;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result] | ANA_AC(cpu->a, *r);
+    cpu->a = result;
 
     return 4;
 }
 
 // ANA M (AND Memory)
-static int ANA_M() {
-    uint8_t result = cpu.a & mem_read(cpu.mem, cpu.hl);
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ZSP);
-    cpu.flags.cy = cpu.flags.ac = 0;
+static int ANA_M(struct cpu *cpu) {
+    uint8_t value = mem_read(cpu->mem, cpu->hl);
+    uint8_t result = cpu->a & value;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result] | ANA_AC(cpu->a, value);
+    cpu->a = result;
 
     return 7;
 }
 
-
 // ANI D8 (AND immediate)
-static int ANI() {
-    cpu_read_byte_to_z();
-    uint8_t result = cpu.a & cpu.z;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ZSP);
-    cpu.flags.cy = cpu.flags.ac = 0;
+static int ANI(struct cpu *cpu) {
+    uint8_t result = cpu->a & cpu->z;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result] | ANA_AC(cpu->a, cpu->z);
+    cpu->a = result;
 
     return 7;
 }
 
 // XRA r (Exclusive OR Register)
-static int XRA(uint8_t *r) {
-    uint8_t result = cpu.a ^ *r;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ZSP);
-    cpu.flags.cy = cpu.flags.ac = 0;
+static int XRA(struct cpu *cpu, uint8_t *r) {
+    uint8_t result = cpu->a ^ *r;
+    cpu->a = result;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result];
 
     return 4;
 }
 
+// XRA M (Exclusive OR memory)
+static int XRA_M(struct cpu *cpu) {
+    uint8_t result = cpu->a ^ mem_read(cpu->mem, cpu->hl);
+    cpu->a = result;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result];
+
+    return 7;
+}
+
+// XRI D8 (Exclusive OR immediate)
+static int XRI(struct cpu *cpu) {
+    uint8_t result = cpu->a ^ cpu->z;
+    cpu->a = result;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result];
+
+    return 7;
+}
+
 // ORA r (OR Register)
-static int ORA(uint8_t *r) {
-    uint8_t result = cpu.a | *r;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ZSP);
-    cpu.flags.cy = cpu.flags.ac = 0;
+static int ORA(struct cpu *cpu, uint8_t *r) {
+    uint8_t result = cpu->a | *r;
+    cpu->a = result;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result];
 
     return 4;
 }
 
 // ORA M (OR memory)
-static int ORA_M() {
-    uint8_t result = cpu.a | mem_read(cpu.mem, cpu.hl);
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ZSP);
-    cpu.flags.cy = cpu.flags.ac = 0;
+static int ORA_M(struct cpu *cpu) {
+    uint8_t result = cpu->a | mem_read(cpu->mem, cpu->hl);
+    cpu->a = result;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result];
 
     return 7;
 }
 
 // ORI D8 (OR immediate)
-static int ORI() {
-    cpu_read_byte_to_z();
-    uint8_t result = cpu.a | cpu.z;
-    cpu.a = result;
-    cpu_handle_flags(result, 8, F_ZSP);
-    cpu.flags.cy = cpu.flags.ac = 0;
+static int ORI(struct cpu *cpu) {
+    uint8_t result = cpu->a | cpu->z;
+    cpu->a = result;
+    cpu->f = (cpu->f & ~F_ALL) | zsp_table[result];
 
     return 7;
 }
 
 // CMP r (Compare register)
-static int CMP(uint8_t *r) {
-    uint16_t result = cpu.a - *r;
-    cpu_handle_flags(result, 8, F_ALL);
+static int CMP(struct cpu *cpu, uint8_t *r) {
+    uint16_t result = cpu->a - *r;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, *r, result);
 
     return 4;
 }
 
 // CMP M (Compare memory)
-static int CMP_M() {
-    uint16_t result = cpu.a - mem_read(cpu.mem, cpu.hl);
-    cpu_handle_flags(result, 8, F_ALL);
+static int CMP_M(struct cpu *cpu) {
+    uint8_t value = mem_read(cpu->mem, cpu->hl);
+    uint16_t result = cpu->a - value;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, value, result);
 
     return 7;
 }
 
 // CPI D8 (Compare immediate)
-static int CPI() {
-    cpu_read_byte_to_z();
-    uint16_t result = cpu.a - cpu.z;
-    cpu_handle_flags(result, 8, F_ALL);
+static int CPI(struct cpu *cpu) {
+    uint16_t result = cpu->a - cpu->z;
+    cpu->f = (cpu->f & ~F_ALL) | SUB_FLAGS(cpu->a, cpu->z, result);
 
     return 7;
 }
 
 // RLC (Rotate left)
-static int RLC() {
-    uint8_t temp = cpu.a;
-    cpu.a = (temp << 1) | (temp & 0x80) >> 7;
-    cpu.flags.cy = (temp & 0x80) >> 7;
+static int RLC(struct cpu *cpu) {
+    uint8_t temp = cpu->a;
+    cpu->a = (temp << 1) | (temp & 0x80) >> 7;
+    cpu->flags.cy = (temp & 0x80) >> 7;
 
     return 4;
 }
 
 // RRC (Rotate Right)
-static int RRC() {
-    uint8_t temp = cpu.a;
-    cpu.a = ((temp & 1) << 7) | (temp >> 1);
-    cpu.flags.cy = (temp & 1);
+static int RRC(struct cpu *cpu) {
+    uint8_t temp = cpu->a;
+    cpu->a = ((temp & 1) << 7) | (temp >> 1);
+    cpu->flags.cy = (temp & 1);
+
+    return 4;
+}
+
+// RAL (Rotate left through carry)
+static int RAL(struct cpu *cpu) {
+    uint8_t temp = cpu->a;
+    cpu->a = (temp << 1) | cpu->flags.cy;
+    cpu->flags.cy = temp >> 7;
 
     return 4;
 }
 
 // RAR (Rotate right through carry)
-static int RAR() {
-    uint8_t temp = cpu.a;
-    cpu.a = (cpu.flags.cy << 7) | (temp >> 1);
-    cpu.flags.cy = (temp & 1);
+static int RAR(struct cpu *cpu) {
+    uint8_t temp = cpu->a;
+    cpu->a = (cpu->flags.cy << 7) | (temp >> 1);
+    cpu->flags.cy = (temp & 1);
 
     return 4;
 }
 
 // CMA (Complement accumulator)
-static int CMA() {
-    cpu.a = ~cpu.a;
+static int CMA(struct cpu *cpu) {
+    cpu->a = ~cpu->a;
 
     return 4;
 }
 
 // STC (Set carry)
-static int STC() {
-    cpu.flags.cy = 1;
+static int STC(struct cpu *cpu) {
+    cpu->flags.cy = 1;
+
+    return 4;
+}
+
+// CMC (Complement carry)
+static int CMC(struct cpu *cpu) {
+    cpu->flags.cy = !cpu->flags.cy;
 
     return 4;
 }
@@ -423,58 +537,80 @@ static int STC() {
  */
 
 // JMP addr (Jump)
-static int JMP() {
-    cpu.pc = cpu.wz;
+static int JMP(struct cpu *cpu) {
+    cpu->pc = cpu->wz;
 
     return 10;
 }
 
 // JZ addr (Conditional jump) (Zero)
-static int JZ() {
-    if (cpu.flags.z) { JMP(); }
+static int JZ(struct cpu *cpu) {
+    if (cpu->flags.z) { cpu->pc = cpu->wz; }
     return 10;
 }
 
 // JNZ addr (Conditional jump) (Not Zero)
-static int JNZ() {
-    if (!cpu.flags.z) { JMP(); }
+static int JNZ(struct cpu *cpu) {
+    if (!cpu->flags.z) { cpu->pc = cpu->wz; }
 
     return 10;
 }
 
 // JC addr (Conditional jump) (Carry)
-static int JC() {
-    if (cpu.flags.cy) { JMP(); }
+static int JC(struct cpu *cpu) {
+    if (cpu->flags.cy) { cpu->pc = cpu->wz; }
 
     return 10;
 }
 
 // JNC addr (Conditional jump) (No Carry)
-static int JNC() {
-    if (!cpu.flags.cy) { JMP(); }
+static int JNC(struct cpu *cpu) {
+    if (!cpu->flags.cy) { cpu->pc = cpu->wz; }
 
     return 10;
 }
 
 // JM addr (Conditional jump) (Minus)
-static int JM() {
-    if (cpu.flags.s) { JMP(); }
+static int JM(struct cpu *cpu) {
+    if (cpu->flags.s) { cpu->pc = cpu->wz; }
+
+    return 10;
+}
+
+// JP addr (Conditional jump) (Plus)
+static int JP(struct cpu *cpu) {
+    if (!cpu->flags.s) { cpu->pc = cpu->wz; }
+
+    return 10;
+}
+
+// JPE addr (Conditional jump) (Parity Even)
+static int JPE(struct cpu *cpu) {
+    if (cpu->flags.p) { cpu->pc = cpu->wz; }
+
+    return 10;
+}
+
+// JPO addr (Conditional jump) (Parity Odd)
+static int JPO(struct cpu *cpu) {
+    if (!cpu->flags.p) { cpu->pc = cpu->wz; }
 
     return 10;
 }
 
 // CALL addr (Call)
-static int CALL() {
-    cpu_push(cpu.pc);
-    cpu.pc = cpu.wz;
+static int CALL(struct cpu *cpu) {
+    cpu_push(cpu, cpu->pc);
+    cpu->pc = cpu->wz;
 
     return 17;
 }
 
 // CZ (Condition call) (Zero)
-static int CZ() {
-    if (cpu.flags.z) {
-        CALL();
+static int CZ(struct cpu *cpu) {
+    if (cpu->flags.z) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
         return 17;
     } else {
         return 11;
@@ -482,9 +618,10 @@ static int CZ() {
 }
 
 // CNZ (Condition call) (Not Zero)
-static int CNZ() {
-    if (!cpu.flags.z) {
-        CALL();
+static int CNZ(struct cpu *cpu) {
+    if (!cpu->flags.z) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
         return 17;
     } else {
         return 11;
@@ -492,9 +629,65 @@ static int CNZ() {
 }
 
 // CNC (Condition call) (Not Carry)
-static int CNC() {
-    if (!cpu.flags.cy) {
-        CALL();
+static int CNC(struct cpu *cpu) {
+    if (!cpu->flags.cy) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
+        return 17;
+    } else {
+        return 11;
+    }
+}
+
+// CC (Condition call) (Carry)
+static int CC(struct cpu *cpu) {
+    if (cpu->flags.cy) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
+        return 17;
+    } else {
+        return 11;
+    }
+}
+
+// CM (Condition call) (Minus)
+static int CM(struct cpu *cpu) {
+    if (cpu->flags.s) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
+        return 17;
+    } else {
+        return 11;
+    }
+}
+
+// CP (Condition call) (Plus)
+static int CP(struct cpu *cpu) {
+    if (!cpu->flags.s) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
+        return 17;
+    } else {
+        return 11;
+    }
+}
+
+// CPE (Condition call) (Parity Even)
+static int CPE(struct cpu *cpu) {
+    if (cpu->flags.p) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
+        return 17;
+    } else {
+        return 11;
+    }
+}
+
+// CPO (Condition call) (Parity Odd)
+static int CPO(struct cpu *cpu) {
+    if (!cpu->flags.p) {
+        cpu_push(cpu, cpu->pc);
+        cpu->pc = cpu->wz;
         return 17;
     } else {
         return 11;
@@ -502,16 +695,16 @@ static int CNC() {
 }
 
 // RET (Return)
-static int RET() {
-    cpu.pc = cpu_pop();
+static int RET(struct cpu *cpu) {
+    cpu->pc = cpu_pop(cpu);
 
     return 10;
 }
 
 // RZ (Conditional Return) (Zero)
-static int RZ() {
-    if (cpu.flags.z) {
-        RET();
+static int RZ(struct cpu *cpu) {
+    if (cpu->flags.z) {
+        RET(cpu);
         return 11;
     } else {
         return 5;
@@ -519,9 +712,9 @@ static int RZ() {
 }
 
 // RNZ (Conditional Return) (Not Zero)
-static int RNZ() {
-    if (!cpu.flags.z) {
-        RET();
+static int RNZ(struct cpu *cpu) {
+    if (!cpu->flags.z) {
+        RET(cpu);
         return 11;
     } else {
         return 5;
@@ -529,9 +722,9 @@ static int RNZ() {
 }
 
 // RC (Conditional Return) (Carry)
-static int RC() {
-    if (cpu.flags.cy) {
-        RET();
+static int RC(struct cpu *cpu) {
+    if (cpu->flags.cy) {
+        RET(cpu);
         return 11;
     } else {
         return 5;
@@ -539,9 +732,49 @@ static int RC() {
 }
 
 // RNC (Conditional Return) (Not Carry)
-static int RNC() {
-    if (!cpu.flags.cy) {
-        RET();
+static int RNC(struct cpu *cpu) {
+    if (!cpu->flags.cy) {
+        RET(cpu);
+        return 11;
+    } else {
+        return 5;
+    }
+}
+
+// RM (Conditional Return) (Minus)
+static int RM(struct cpu *cpu) {
+    if (cpu->flags.s) {
+        RET(cpu);
+        return 11;
+    } else {
+        return 5;
+    }
+}
+
+// RP (Conditional Return) (Plus)
+static int RP(struct cpu *cpu) {
+    if (!cpu->flags.s) {
+        RET(cpu);
+        return 11;
+    } else {
+        return 5;
+    }
+}
+
+// RPE (Conditional Return) (Parity Even)
+static int RPE(struct cpu *cpu) {
+    if (cpu->flags.p) {
+        RET(cpu);
+        return 11;
+    } else {
+        return 5;
+    }
+}
+
+// RPO (Conditional Return) (Parity Odd)
+static int RPO(struct cpu *cpu) {
+    if (!cpu->flags.p) {
+        RET(cpu);
         return 11;
     } else {
         return 5;
@@ -549,12 +782,20 @@ static int RNC() {
 }
 
 // PCHL (Jump HL indirect, move HL to PC)
-static int PCHL() {
-    cpu.pc = cpu.hl;
+static int PCHL(struct cpu *cpu) {
+    cpu->pc = cpu->hl;
 
     return 5;
 }
 
+// RST n (Restart, call 8 * n)
+static int RST(struct cpu *cpu, uint16_t addr) {
+    cpu_push(cpu, cpu->pc);
+    cpu->pc = addr;
+
+    return 11;
+}
+
 
 
 /*
@@ -562,510 +803,710 @@ static int PCHL() {
  */
 
 // PUSH B (Push)
-static int PUSH_B() {
-    cpu_push(cpu.bc);
+static int PUSH_B(struct cpu *cpu) {
+    cpu_push(cpu, cpu->bc);
 
     return 11;
 }
 
 // PUSH D (Push)
-static int PUSH_D() {
-    cpu_push(cpu.de);
+static int PUSH_D(struct cpu *cpu) {
+    cpu_push(cpu, cpu->de);
 
     return 11;
 }
 
 // PUSH H (Push)
-static int PUSH_H() {
-    cpu_push(cpu.hl);
+static int PUSH_H(struct cpu *cpu) {
+    cpu_push(cpu, cpu->hl);
 
     return 11;
 }
 
-// PUSH PSW (Push processor status word) [Note: And accumulator]
-static int PUSH_PSW() {
-    cpu_push(cpu.af);
+// PUSH PSW (Push processor status word) [Note: And accumulator]. Bit 1 of
+// the pushed status is always set, bits 3 and 5 always clear.
+static int PUSH_PSW(struct cpu *cpu) {
+    cpu_push(cpu, cpu->a << 8 | (cpu->f & F_ALL) | 0x02);
 
     return 11;
 }
 
 // POP B (Pop)
-static int POP_B() {
-    cpu.bc = cpu_pop();
+static int POP_B(struct cpu *cpu) {
+    cpu->bc = cpu_pop(cpu);
 
     return 10;
 }
 
 // POP D (Pop)
-static int POP_D() {
-    cpu.de = cpu_pop();
+static int POP_D(struct cpu *cpu) {
+    cpu->de = cpu_pop(cpu);
 
     return 10;
 }
 
 // POP H (Pop)
-static int POP_H() {
-    cpu.hl = cpu_pop();
+static int POP_H(struct cpu *cpu) {
+    cpu->hl = cpu_pop(cpu);
 
     return 10;
 }
 
 // POP PSW (Pop processor status word)
-static int POP_PSW() {
-    cpu.af = cpu_pop();
+static int POP_PSW(struct cpu *cpu) {
+    cpu->af = cpu_pop(cpu);
+    cpu->f &= F_ALL;
 
     return 10;
 }
 
 // XTHL (Exchange stack top with H and L)
-static int XTHL() {
-    uint16_t temp = cpu_pop();
-    cpu_push(cpu.hl);
-    cpu.hl = temp;
+static int XTHL(struct cpu *cpu) {
+    uint16_t temp = cpu_pop(cpu);
+    cpu_push(cpu, cpu->hl);
+    cpu->hl = temp;
 
     return 18;
 }
 
+// SPHL (Move HL to SP)
+static int SPHL(struct cpu *cpu) {
+    cpu->sp = cpu->hl;
+
+    return 5;
+}
+
 // IN port (Input)
-static int IN() {
-    cpu_read_byte_to_z();
-    uint8_t port = cpu.z;
-    if (port == 3) { return 10; }
-    cpu.a = cpu.ports[port];
+static int IN(struct cpu *cpu) {
+    if (cpu->in) { cpu->a = cpu->in(cpu, cpu->z); }
 
     return 10;
 }
 
 // OUT port (Output)
-static int OUT() {
-    cpu_read_byte_to_z();
-    uint8_t port = cpu.z;
-    if (port == 2 || port == 4) { return 10; }
-    cpu.ports[port] = cpu.a;
+static int OUT(struct cpu *cpu) {
+    if (cpu->out) { cpu->out(cpu, cpu->z, cpu->a); }
 
     return 10;
 }
 
 // EI (Enable interrupts)
-static int EI() {
-    cpu.flags.i = 1;
+static int EI(struct cpu *cpu) {
+    cpu->inte = 1;
 
     return 4;
 }
 
-static int NOP() {
+// DI (Disable interrupts)
+static int DI(struct cpu *cpu) {
+    cpu->inte = 0;
+
     return 4;
 }
 
+// HLT (Halt). PC stays on the HLT, so it keeps running until an interrupt
+// moves past it.
+static int HLT(struct cpu *cpu) {
+    cpu->pc--;
+    cpu->halted = 1;
+
+    return 7;
+}
 
-void cpu_dump() {
-    printf("IR:   0x%02x  ", cpu.ir);
-    printf("PC: 0x%04x  ", cpu.pc);
-    printf("SP: 0x%04x\n", cpu.sp);
-    printf("BC: 0x%04x  ", cpu.bc);
-    printf("DE: 0x%04x  ", cpu.de);
-    printf("HL: 0x%04x  ", cpu.hl);
-    printf("AF: 0x%04x\n", cpu.af);
+static int NOP(struct cpu *cpu) {
+    return 4;
 }
 
 
-void cpu_fetch() {
-    cpu.ir = mem_read(cpu.mem, cpu.pc);
-    cpu.pc++;
+void cpu_dump(struct cpu *cpu) {
+    printf("IR:   0x%02x  ", cpu->ir);
+    printf("PC: 0x%04x  ", cpu->pc);
+    printf("SP: 0x%04x\n", cpu->sp);
+    printf("BC: 0x%04x  ", cpu->bc);
+    printf("DE: 0x%04x  ", cpu->de);
+    printf("HL: 0x%04x  ", cpu->hl);
+    printf("AF: 0x%04x\n", cpu->af);
 }
 
 
-void cpu_read_bytes_to_wz() {
-    cpu.z = mem_read(cpu.mem, cpu.pc);
-    cpu.w = mem_read(cpu.mem, cpu.pc+1);
+// Fetch the next instruction: the opcode goes to IR and its operands, if
+// any, to Z (one byte) or WZ (two bytes), leaving PC at the next instruction
+void cpu_fetch(struct cpu *cpu) {
+    cpu->ir = mem_read(cpu->mem, cpu->pc);
+    cpu->pc++;
+    cpu->instructions++;
 
-    cpu.pc += 2;
+    switch (disasm_ops[cpu->ir].length) {
+        case 2:
+            cpu_read_byte_to_z(cpu);
+            break;
+        case 3:
+            cpu_read_bytes_to_wz(cpu);
+            break;
+    }
 }
 
 
-void cpu_read_byte_to_z() {
-    cpu.z = mem_read(cpu.mem, cpu.pc);
-
-    cpu.pc++;
+int cpu_length(uint8_t op) {
+    return disasm_ops[op].length;
 }
 
 
+void cpu_read_bytes_to_wz(struct cpu *cpu) {
+    cpu->z = mem_read(cpu->mem, cpu->pc);
+    cpu->w = mem_read(cpu->mem, cpu->pc+1);
 
-void cpu_handle_flags(uint32_t result, size_t size, int flags) {
-    if (flags & f_z) {
-        // TODO Will be wrong if result has overflowed
-        cpu.flags.z = (result == 0);
-    }
+    cpu->pc += 2;
+}
 
-    if (flags & f_p) {
-        cpu.flags.p = (result & 1) == 0;
-    }
 
-    if (flags & f_s) {
-        cpu.flags.s = (result & (1 << (size-1))) >> (size-1) == 1;
-    }
+void cpu_read_byte_to_z(struct cpu *cpu) {
+    cpu->z = mem_read(cpu->mem, cpu->pc);
 
-    if (flags & f_cy) {
-        cpu.flags.cy = (result & ((0xfffffff) << size)) != 0;
-    }
+    cpu->pc++;
 }
 
-void cpu_push(uint16_t value) {
-    mem_write(cpu.mem, cpu.sp-1, value >> 8);
-    mem_write(cpu.mem, cpu.sp-2, value);
 
-    cpu.sp -= 2;
+
+void cpu_push(struct cpu *cpu, uint16_t value) {
+    mem_write(cpu->mem, cpu->sp-1, value >> 8);
+    mem_write(cpu->mem, cpu->sp-2, value);
+
+    cpu->sp -= 2;
 }
 
-uint16_t cpu_pop() {
-    uint16_t r = (mem_read(cpu.mem, cpu.sp+1) << 8) | mem_read(cpu.mem, cpu.sp);
+uint16_t cpu_pop(struct cpu *cpu) {
+    uint16_t r = (mem_read(cpu->mem, cpu->sp+1) << 8) | mem_read(cpu->mem, cpu->sp);
 
-    cpu.sp += 2;
+    cpu->sp += 2;
 
     return r;
 }
 
 
-int cpu_run_instruction() {
-    switch (cpu.ir) {
-        case 0x00:  // NOP
-            return NOP();
-
-        case 0x40:  // MOV B, B
-            return MOV(&cpu.b, &cpu.b);
-        case 0x41:  // MOV B, C
-            return MOV(&cpu.b, &cpu.c);
-        case 0x42:  // MOV B, D
-            return MOV(&cpu.b, &cpu.d);
-        case 0x43:  // MOV B, E
-            return MOV(&cpu.b, &cpu.e);
-        case 0x44:  // MOV B, H
-            return MOV(&cpu.b, &cpu.h);
-        case 0x47:  // MOV B, A
-            return MOV(&cpu.b, &cpu.a);
-        case 0x48:  // MOV C, B
-            return MOV(&cpu.c, &cpu.b);
-        case 0x4f:  // MOV C, A
-            return MOV(&cpu.c, &cpu.a);
-        case 0x57:  // MOV D, A
-            return MOV(&cpu.d, &cpu.a);
-        case 0x5f:  // MOV E, A
-            return MOV(&cpu.e, &cpu.a);
-        case 0x61:  // MOV H, C
-            return MOV(&cpu.h, &cpu.c);
-        case 0x64:  // MOV H, H
-            return MOV(&cpu.h, &cpu.h);
-        case 0x65:  // MOV H, L
-            return MOV(&cpu.h, &cpu.l);
-        case 0x67:  // MOV H, A
-            return MOV(&cpu.h, &cpu.a);
-        case 0x68:  // MOV L, B
-            return MOV(&cpu.l, &cpu.b);
-        case 0x69:  // MOV L, C
-            return MOV(&cpu.l, &cpu.c);
-        case 0x6f:  // MOV L, A
-            return MOV(&cpu.l, &cpu.a);
-        case 0x78:  // MOV A, B
-            return MOV(&cpu.a, &cpu.b);
-        case 0x79:  // MOV A, C
-            return MOV(&cpu.a, &cpu.c);
-        case 0x7a:  // MOV A, D
-            return MOV(&cpu.a, &cpu.d);
-        case 0x7b:  // MOV A, E
-            return MOV(&cpu.a, &cpu.e);
-        case 0x7c:  // MOV A, H
-            return MOV(&cpu.a, &cpu.h);
-        case 0x7d:  // MOV A, L
-            return MOV(&cpu.a, &cpu.l);
-
-        case 0x46:  // MOV B, M
-            return MOV_from_mem(&cpu.b);
-        case 0x4e:  // MOV C, M
-            return MOV_from_mem(&cpu.c);
-        case 0x5e:  // MOV E, M
-            return MOV_from_mem(&cpu.e);
-        case 0x7e:  // MOV A, M
-            return MOV_from_mem(&cpu.a);
-        case 0x56:  // MOV D, M
-            return MOV_from_mem(&cpu.d);
-        case 0x66:  // MOV H, M
-            return MOV_from_mem(&cpu.h);
-
-        case 0x70:  // MOV M, B
-            return MOV_to_mem(&cpu.b);
-        case 0x71:  // MOV M, C
-            return MOV_to_mem(&cpu.c);
-        case 0x72:  // MOV M, D
-            return MOV_to_mem(&cpu.d);
-        case 0x73:  // MOV M, E
-            return MOV_to_mem(&cpu.e);
-        case 0x77:  // MOV M, A
-            return MOV_to_mem(&cpu.a);
-
-        case 0x01:  // LXI B, D16
-            return LXI(&cpu.bc);
-        case 0x11:  // LXI D, D16
-            return LXI(&cpu.de);
-        case 0x21:  // LXI H, D16
-            return LXI(&cpu.hl);
-        case 0x31:  // LXI SP, D16
-            return LXI(&cpu.sp);
-
-        case 0x06:  // MVI B, D8
-            return MVI(&cpu.b);
-        case 0x16:  // MVI D, D8
-            return MVI(&cpu.d);
-        case 0x0e:  // MVI C, D8
-            return MVI(&cpu.c);
-        case 0x1e:  // MVI E, D8
-            return MVI(&cpu.e);
-        case 0x26:  // MVI H, D8
-            return MVI(&cpu.h);
-        case 0x2e:  // MVI L, D8
-            return MVI(&cpu.l);
-        case 0x3e:  // MVI A, D8
-            return MVI(&cpu.a);
-
-        case 0x36:  // MVI M, D8
-            return MVI_to_mem();
-
-        case 0x0a:  // LDAX B
-            return LDAX_B();
-        case 0x1a:  // LDAX D
-            return LDAX_D();
-
-        case 0x3a:  // LDA D16
-            return LDA();
-
-        case 0x32:  // STA D16
-            return STA();
-
-        case 0x02:  // STAX B
-            return STAX_B();
-        case 0x12:  // STAX D
-            return STAX_D();
-
-        case 0x2a:  // LHLD addr
-            return LHLD();
-
-        case 0x22:  // SHLD addr
-            return SHLD();
-
-        case 0xeb:  // XCHG
-            return XCHG();
-
-        case 0x80: // ADD B
-            return ADD(&cpu.b);
-        case 0x81: // ADD C
-            return ADD(&cpu.c);
-        case 0x82: // ADD D
-            return ADD(&cpu.d);
-        case 0x83: // ADD E
-            return ADD(&cpu.e);
-        case 0x85: // ADD L
-            return ADD(&cpu.l);
-
-        case 0x86: // ADD M
-            return ADD_M();
-
-        case 0x04: // INR B
-            return INR(&cpu.b);
-        case 0x0c: // INR C
-            return INR(&cpu.c);
-        case 0x14: // INR D
-            return INR(&cpu.d);
-        case 0x1c: // INR E
-            return INR(&cpu.e);
-        case 0x24: // INR H
-            return INR(&cpu.h);
-        case 0x2c: // INR L
-            return INR(&cpu.l);
-        case 0x3c: // INR A
-            return INR(&cpu.a);
-
-        case 0x34: // INR M
-            return INR_M();
-
-        case 0x05: // DCR B
-            return DCR(&cpu.b);
-        case 0x0d: // DCR C
-            return DCR(&cpu.c);
-        case 0x15: // DCR D
-            return DCR(&cpu.d);
-        case 0x25: // DCR H
-            return DCR(&cpu.h);
-        case 0x3d: // DCR A
-            return DCR(&cpu.a);
-
-        case 0x35: // DCR M
-            return DCR_M();
-
-        case 0x03: // INX B
-            return INX(&cpu.bc);
-        case 0x13: // INX D
-            return INX(&cpu.de);
-        case 0x23: // INX H
-            return INX(&cpu.hl);
-
-        case 0x1b: // DCX D
-            return DCX(&cpu.de);
-        case 0x2b: // DCX H
-            return DCX(&cpu.hl);
-
-        case 0x09: // DAD B
-            return DAD(&cpu.bc);
-        case 0x19: // DAD D
-            return DAD(&cpu.de);
-        case 0x29: // DAD H
-            return DAD(&cpu.hl);
-
-        case 0xc6: // ADI D8
-            return ADI();
-
-        case 0x8a: // ADC D
-            return ADC(&cpu.d);
-
-        case 0x97: // SUB A
-            return SUB(&cpu.a);
-
-        case 0xd6: // SUI D8
-            return SUI();
-
-        case 0xde: // SBI D8
-            return SBI();
-
-        case 0x27: // DAA
-            return DAA();
-
-        case 0xa0: // ANA B
-            return ANA(&cpu.b);
-        case 0xa1: // ANA C
-            return ANA(&cpu.c);
-        case 0xa7: // ANA A
-            return ANA(&cpu.a);
-
-        case 0xa6: // ANA M
-            return ANA_M();
-
-        case 0xe6: // ANI D8
-            return ANI();
-
-        case 0xa8: // XRA B
-            return XRA(&cpu.b);
-        case 0xaf: // XRA A
-            return XRA(&cpu.a);
-
-        case 0xb0: // ORA B
-            return ORA(&cpu.b);
-        case 0xb4: // ORA H
-            return ORA(&cpu.h);
-
-        case 0xb6: // ORA M
-            return ORA_M();
-
-        case 0xf6: // ORI D8
-            return ORI();
-
-        case 0xb8: // CMP B
-            return CMP(&cpu.b);
-        case 0xbc: // CMP H
-            return CMP(&cpu.h);
-
-        case 0xbe: // CMP M
-            return CMP_M();
-
-        case 0xfe: // CPI D8
-            return CPI();
-
-        case 0x07: // RLC
-            return RLC();
-        case 0x0f: // RRC
-            return RRC();
-        case 0x1f: // RAR
-            return RAR();
-
-        case 0x2f: // CMA
-            return CMA();
-        case 0x37: // STC
-            return STC();
-
-        case 0xc3:  // JMP addr
-            cpu_read_bytes_to_wz();
-            return JMP();
-        case 0xca:  // JZ addr
-            cpu_read_bytes_to_wz();
-            return JZ();
-        case 0xc2:  // JNZ addr
-            cpu_read_bytes_to_wz();
-            return JNZ();
-        case 0xda:  // JC addr
-            cpu_read_bytes_to_wz();
-            return JC();
-        case 0xd2:  // JNC addr
-            cpu_read_bytes_to_wz();
-            return JNC();
-        case 0xfa:  // JM addr
-            cpu_read_bytes_to_wz();
-            return JM();
-
-        case 0xcd:  // CALL addr
-            cpu_read_bytes_to_wz();
-            return CALL();
-        case 0xcc:  // CZ addr
-            cpu_read_bytes_to_wz();
-            return CZ();
-        case 0xc4:  // CNZ addr
-            cpu_read_bytes_to_wz();
-            return CNZ();
-        case 0xd4:  // CNC addr
-            cpu_read_bytes_to_wz();
-            return CNC();
-
-        case 0xc9:  // RET
-            return RET();
-        case 0xc8:  // RZ
-            return RZ();
-        case 0xc0:  // RNZ
-            return RNZ();
-        case 0xd8:  // RC
-            return RC();
-        case 0xd0:  // RNC
-            return RNC();
-
-        case 0xe9:  // PCHL
-            return PCHL();
-
-        case 0xc5:  // PUSH B
-            return PUSH_B();
-        case 0xd5:  // PUSH D
-            return PUSH_D();
-        case 0xe5:  // PUSH H
-            return PUSH_H();
-
-        case 0xf5:  // PUSH PSW
-            return PUSH_PSW();
-
-        case 0xc1:  // POP B
-            return POP_B();
-        case 0xd1:  // POP D
-            return POP_D();
-        case 0xe1:  // POP H
-            return POP_H();
-
-        case 0xf1:  // POP PSW
-            return POP_PSW();
-        case 0xe3:  // XTHL
-            return XTHL();
-
-        case 0xdb:  // IN D8
-            return IN();
-        case 0xd3:  // OUT D8
-            return OUT();
-
-        case 0xfb:  // EI
-            return EI();
+/*
+ * Dispatch
+ *
+ * OPCODES lists every instruction next to the handler call that executes it,
+ * and is expanded into whichever dispatcher the build selects:
+ *
+ *   CPU_DISPATCH_SWITCH  one big switch on cpu->ir (the reference version)
+ *   CPU_DISPATCH_TABLE   a 256-entry table of per-opcode handler functions
+ *   (default on GCC)     the handler table for single steps, plus a threaded
+ *                        cpu_run() that jumps straight from the end of one
+ *                        instruction to the label of the next one
+ *
+ * The handler table is built in every configuration, cpu_handler() exposes it.
+ */
+
+#define OPCODES(X) \
+    X(0x00, NOP(cpu))                    /* NOP */ \
+    X(0x08, NOP(cpu))                    /* NOP (undocumented) */ \
+    X(0x10, NOP(cpu))                    /* NOP (undocumented) */ \
+    X(0x18, NOP(cpu))                    /* NOP (undocumented) */ \
+    X(0x20, NOP(cpu))                    /* NOP (undocumented) */ \
+    X(0x28, NOP(cpu))                    /* NOP (undocumented) */ \
+    X(0x30, NOP(cpu))                    /* NOP (undocumented) */ \
+    X(0x38, NOP(cpu))                    /* NOP (undocumented) */ \
+    \
+    X(0x40, MOV(cpu, &cpu->b, &cpu->b))  /* MOV B, B */ \
+    X(0x41, MOV(cpu, &cpu->b, &cpu->c))  /* MOV B, C */ \
+    X(0x42, MOV(cpu, &cpu->b, &cpu->d))  /* MOV B, D */ \
+    X(0x43, MOV(cpu, &cpu->b, &cpu->e))  /* MOV B, E */ \
+    X(0x44, MOV(cpu, &cpu->b, &cpu->h))  /* MOV B, H */ \
+    X(0x45, MOV(cpu, &cpu->b, &cpu->l))  /* MOV B, L */ \
+    X(0x47, MOV(cpu, &cpu->b, &cpu->a))  /* MOV B, A */ \
+    X(0x48, MOV(cpu, &cpu->c, &cpu->b))  /* MOV C, B */ \
+    X(0x49, MOV(cpu, &cpu->c, &cpu->c))  /* MOV C, C */ \
+    X(0x4a, MOV(cpu, &cpu->c, &cpu->d))  /* MOV C, D */ \
+    X(0x4b, MOV(cpu, &cpu->c, &cpu->e))  /* MOV C, E */ \
+    X(0x4c, MOV(cpu, &cpu->c, &cpu->h))  /* MOV C, H */ \
+    X(0x4d, MOV(cpu, &cpu->c, &cpu->l))  /* MOV C, L */ \
+    X(0x4f, MOV(cpu, &cpu->c, &cpu->a))  /* MOV C, A */ \
+    X(0x50, MOV(cpu, &cpu->d, &cpu->b))  /* MOV D, B */ \
+    X(0x51, MOV(cpu, &cpu->d, &cpu->c))  /* MOV D, C */ \
+    X(0x52, MOV(cpu, &cpu->d, &cpu->d))  /* MOV D, D */ \
+    X(0x53, MOV(cpu, &cpu->d, &cpu->e))  /* MOV D, E */ \
+    X(0x54, MOV(cpu, &cpu->d, &cpu->h))  /* MOV D, H */ \
+    X(0x55, MOV(cpu, &cpu->d, &cpu->l))  /* MOV D, L */ \
+    X(0x57, MOV(cpu, &cpu->d, &cpu->a))  /* MOV D, A */ \
+    X(0x58, MOV(cpu, &cpu->e, &cpu->b))  /* MOV E, B */ \
+    X(0x59, MOV(cpu, &cpu->e, &cpu->c))  /* MOV E, C */ \
+    X(0x5a, MOV(cpu, &cpu->e, &cpu->d))  /* MOV E, D */ \
+    X(0x5b, MOV(cpu, &cpu->e, &cpu->e))  /* MOV E, E */ \
+    X(0x5c, MOV(cpu, &cpu->e, &cpu->h))  /* MOV E, H */ \
+    X(0x5d, MOV(cpu, &cpu->e, &cpu->l))  /* MOV E, L */ \
+    X(0x5f, MOV(cpu, &cpu->e, &cpu->a))  /* MOV E, A */ \
+    X(0x60, MOV(cpu, &cpu->h, &cpu->b))  /* MOV H, B */ \
+    X(0x61, MOV(cpu, &cpu->h, &cpu->c))  /* MOV H, C */ \
+    X(0x62, MOV(cpu, &cpu->h, &cpu->d))  /* MOV H, D */ \
+    X(0x63, MOV(cpu, &cpu->h, &cpu->e))  /* MOV H, E */ \
+    X(0x64, MOV(cpu, &cpu->h, &cpu->h))  /* MOV H, H */ \
+    X(0x65, MOV(cpu, &cpu->h, &cpu->l))  /* MOV H, L */ \
+    X(0x67, MOV(cpu, &cpu->h, &cpu->a))  /* MOV H, A */ \
+    X(0x68, MOV(cpu, &cpu->l, &cpu->b))  /* MOV L, B */ \
+    X(0x69, MOV(cpu, &cpu->l, &cpu->c))  /* MOV L, C */ \
+    X(0x6a, MOV(cpu, &cpu->l, &cpu->d))  /* MOV L, D */ \
+    X(0x6b, MOV(cpu, &cpu->l, &cpu->e))  /* MOV L, E */ \
+    X(0x6c, MOV(cpu, &cpu->l, &cpu->h))  /* MOV L, H */ \
+    X(0x6d, MOV(cpu, &cpu->l, &cpu->l))  /* MOV L, L */ \
+    X(0x6f, MOV(cpu, &cpu->l, &cpu->a))  /* MOV L, A */ \
+    X(0x78, MOV(cpu, &cpu->a, &cpu->b))  /* MOV A, B */ \
+    X(0x79, MOV(cpu, &cpu->a, &cpu->c))  /* MOV A, C */ \
+    X(0x7a, MOV(cpu, &cpu->a, &cpu->d))  /* MOV A, D */ \
+    X(0x7b, MOV(cpu, &cpu->a, &cpu->e))  /* MOV A, E */ \
+    X(0x7c, MOV(cpu, &cpu->a, &cpu->h))  /* MOV A, H */ \
+    X(0x7d, MOV(cpu, &cpu->a, &cpu->l))  /* MOV A, L */ \
+    X(0x7f, MOV(cpu, &cpu->a, &cpu->a))  /* MOV A, A */ \
+    \
+    X(0x46, MOV_from_mem(cpu, &cpu->b))  /* MOV B, M */ \
+    X(0x4e, MOV_from_mem(cpu, &cpu->c))  /* MOV C, M */ \
+    X(0x56, MOV_from_mem(cpu, &cpu->d))  /* MOV D, M */ \
+    X(0x5e, MOV_from_mem(cpu, &cpu->e))  /* MOV E, M */ \
+    X(0x66, MOV_from_mem(cpu, &cpu->h))  /* MOV H, M */ \
+    X(0x6e, MOV_from_mem(cpu, &cpu->l))  /* MOV L, M */ \
+    X(0x7e, MOV_from_mem(cpu, &cpu->a))  /* MOV A, M */ \
+    \
+    X(0x70, MOV_to_mem(cpu, &cpu->b))    /* MOV M, B */ \
+    X(0x71, MOV_to_mem(cpu, &cpu->c))    /* MOV M, C */ \
+    X(0x72, MOV_to_mem(cpu, &cpu->d))    /* MOV M, D */ \
+    X(0x73, MOV_to_mem(cpu, &cpu->e))    /* MOV M, E */ \
+    X(0x74, MOV_to_mem(cpu, &cpu->h))    /* MOV M, H */ \
+    X(0x75, MOV_to_mem(cpu, &cpu->l))    /* MOV M, L */ \
+    X(0x77, MOV_to_mem(cpu, &cpu->a))    /* MOV M, A */ \
+    \
+    X(0x01, LXI(cpu, &cpu->bc))          /* LXI B, D16 */ \
+    X(0x11, LXI(cpu, &cpu->de))          /* LXI D, D16 */ \
+    X(0x21, LXI(cpu, &cpu->hl))          /* LXI H, D16 */ \
+    X(0x31, LXI(cpu, &cpu->sp))          /* LXI SP, D16 */ \
+    \
+    X(0x06, MVI(cpu, &cpu->b))           /* MVI B, D8 */ \
+    X(0x0e, MVI(cpu, &cpu->c))           /* MVI C, D8 */ \
+    X(0x16, MVI(cpu, &cpu->d))           /* MVI D, D8 */ \
+    X(0x1e, MVI(cpu, &cpu->e))           /* MVI E, D8 */ \
+    X(0x26, MVI(cpu, &cpu->h))           /* MVI H, D8 */ \
+    X(0x2e, MVI(cpu, &cpu->l))           /* MVI L, D8 */ \
+    X(0x3e, MVI(cpu, &cpu->a))           /* MVI A, D8 */ \
+    \
+    X(0x36, MVI_to_mem(cpu))             /* MVI M, D8 */ \
+    \
+    X(0x0a, LDAX_B(cpu))                 /* LDAX B */ \
+    X(0x1a, LDAX_D(cpu))                 /* LDAX D */ \
+    \
+    X(0x3a, LDA(cpu))                    /* LDA D16 */ \
+    \
+    X(0x32, STA(cpu))                    /* STA D16 */ \
+    \
+    X(0x02, STAX_B(cpu))                 /* STAX B */ \
+    X(0x12, STAX_D(cpu))                 /* STAX D */ \
+    \
+    X(0x2a, LHLD(cpu))                   /* LHLD addr */ \
+    \
+    X(0x22, SHLD(cpu))                   /* SHLD addr */ \
+    \
+    X(0xeb, XCHG(cpu))                   /* XCHG */ \
+    \
+    X(0x80, ADD(cpu, &cpu->b))           /* ADD B */ \
+    X(0x81, ADD(cpu, &cpu->c))           /* ADD C */ \
+    X(0x82, ADD(cpu, &cpu->d))           /* ADD D */ \
+    X(0x83, ADD(cpu, &cpu->e))           /* ADD E */ \
+    X(0x84, ADD(cpu, &cpu->h))           /* ADD H */ \
+    X(0x85, ADD(cpu, &cpu->l))           /* ADD L */ \
+    X(0x87, ADD(cpu, &cpu->a))           /* ADD A */ \
+    \
+    X(0x86, ADD_M(cpu))                  /* ADD M */ \
+    \
+    X(0xc6, ADI(cpu))                    /* ADI D8 */ \
+    \
+    X(0x88, ADC(cpu, &cpu->b))           /* ADC B */ \
+    X(0x89, ADC(cpu, &cpu->c))           /* ADC C */ \
+    X(0x8a, ADC(cpu, &cpu->d))           /* ADC D */ \
+    X(0x8b, ADC(cpu, &cpu->e))           /* ADC E */ \
+    X(0x8c, ADC(cpu, &cpu->h))           /* ADC H */ \
+    X(0x8d, ADC(cpu, &cpu->l))           /* ADC L */ \
+    X(0x8f, ADC(cpu, &cpu->a))           /* ADC A */ \
+    \
+    X(0x8e, ADC_M(cpu))                  /* ADC M */ \
+    \
+    X(0xce, ACI(cpu))                    /* ACI D8 */ \
+    \
+    X(0x90, SUB(cpu, &cpu->b))           /* SUB B */ \
+    X(0x91, SUB(cpu, &cpu->c))           /* SUB C */ \
+    X(0x92, SUB(cpu, &cpu->d))           /* SUB D */ \
+    X(0x93, SUB(cpu, &cpu->e))           /* SUB E */ \
+    X(0x94, SUB(cpu, &cpu->h))           /* SUB H */ \
+    X(0x95, SUB(cpu, &cpu->l))           /* SUB L */ \
+    X(0x97, SUB(cpu, &cpu->a))           /* SUB A */ \
+    \
+    X(0x96, SUB_M(cpu))                  /* SUB M */ \
+    \
+    X(0xd6, SUI(cpu))                    /* SUI D8 */ \
+    \
+    X(0x98, SBB(cpu, &cpu->b))           /* SBB B */ \
+    X(0x99, SBB(cpu, &cpu->c))           /* SBB C */ \
+    X(0x9a, SBB(cpu, &cpu->d))           /* SBB D */ \
+    X(0x9b, SBB(cpu, &cpu->e))           /* SBB E */ \
+    X(0x9c, SBB(cpu, &cpu->h))           /* SBB H */ \
+    X(0x9d, SBB(cpu, &cpu->l))           /* SBB L */ \
+    X(0x9f, SBB(cpu, &cpu->a))           /* SBB A */ \
+    \
+    X(0x9e, SBB_M(cpu))                  /* SBB M */ \
+    \
+    X(0xde, SBI(cpu))                    /* SBI D8 */ \
+    \
+    X(0x04, INR(cpu, &cpu->b))           /* INR B */ \
+    X(0x0c, INR(cpu, &cpu->c))           /* INR C */ \
+    X(0x14, INR(cpu, &cpu->d))           /* INR D */ \
+    X(0x1c, INR(cpu, &cpu->e))           /* INR E */ \
+    X(0x24, INR(cpu, &cpu->h))           /* INR H */ \
+    X(0x2c, INR(cpu, &cpu->l))           /* INR L */ \
+    X(0x3c, INR(cpu, &cpu->a))           /* INR A */ \
+    \
+    X(0x34, INR_M(cpu))                  /* INR M */ \
+    \
+    X(0x05, DCR(cpu, &cpu->b))           /* DCR B */ \
+    X(0x0d, DCR(cpu, &cpu->c))           /* DCR C */ \
+    X(0x15, DCR(cpu, &cpu->d))           /* DCR D */ \
+    X(0x1d, DCR(cpu, &cpu->e))           /* DCR E */ \
+    X(0x25, DCR(cpu, &cpu->h))           /* DCR H */ \
+    X(0x2d, DCR(cpu, &cpu->l))           /* DCR L */ \
+    X(0x3d, DCR(cpu, &cpu->a))           /* DCR A */ \
+    \
+    X(0x35, DCR_M(cpu))                  /* DCR M */ \
+    \
+    X(0x03, INX(cpu, &cpu->bc))          /* INX B */ \
+    X(0x13, INX(cpu, &cpu->de))          /* INX D */ \
+    X(0x23, INX(cpu, &cpu->hl))          /* INX H */ \
+    X(0x33, INX(cpu, &cpu->sp))          /* INX SP */ \
+    \
+    X(0x0b, DCX(cpu, &cpu->bc))          /* DCX B */ \
+    X(0x1b, DCX(cpu, &cpu->de))          /* DCX D */ \
+    X(0x2b, DCX(cpu, &cpu->hl))          /* DCX H */ \
+    X(0x3b, DCX(cpu, &cpu->sp))          /* DCX SP */ \
+    \
+    X(0x09, DAD(cpu, &cpu->bc))          /* DAD B */ \
+    X(0x19, DAD(cpu, &cpu->de))          /* DAD D */ \
+    X(0x29, DAD(cpu, &cpu->hl))          /* DAD H */ \
+    X(0x39, DAD(cpu, &cpu->sp))          /* DAD SP */ \
+    \
+    X(0x27, DAA(cpu))                    /* DAA */ \
+    \
+    X(0xa0, ANA(cpu, &cpu->b))           /* ANA B */ \
+    X(0xa1, ANA(cpu, &cpu->c))           /* ANA C */ \
+    X(0xa2, ANA(cpu, &cpu->d))           /* ANA D */ \
+    X(0xa3, ANA(cpu, &cpu->e))           /* ANA E */ \
+    X(0xa4, ANA(cpu, &cpu->h))           /* ANA H */ \
+    X(0xa5, ANA(cpu, &cpu->l))           /* ANA L */ \
+    X(0xa7, ANA(cpu, &cpu->a))           /* ANA A */ \
+    \
+    X(0xa6, ANA_M(cpu))                  /* ANA M */ \
+    \
+    X(0xe6, ANI(cpu))                    /* ANI D8 */ \
+    \
+    X(0xa8, XRA(cpu, &cpu->b))           /* XRA B */ \
+    X(0xa9, XRA(cpu, &cpu->c))           /* XRA C */ \
+    X(0xaa, XRA(cpu, &cpu->d))           /* XRA D */ \
+    X(0xab, XRA(cpu, &cpu->e))           /* XRA E */ \
+    X(0xac, XRA(cpu, &cpu->h))           /* XRA H */ \
+    X(0xad, XRA(cpu, &cpu->l))           /* XRA L */ \
+    X(0xaf, XRA(cpu, &cpu->a))           /* XRA A */ \
+    \
+    X(0xae, XRA_M(cpu))                  /* XRA M */ \
+    \
+    X(0xee, XRI(cpu))                    /* XRI D8 */ \
+    \
+    X(0xb0, ORA(cpu, &cpu->b))           /* ORA B */ \
+    X(0xb1, ORA(cpu, &cpu->c))           /* ORA C */ \
+    X(0xb2, ORA(cpu, &cpu->d))           /* ORA D */ \
+    X(0xb3, ORA(cpu, &cpu->e))           /* ORA E */ \
+    X(0xb4, ORA(cpu, &cpu->h))           /* ORA H */ \
+    X(0xb5, ORA(cpu, &cpu->l))           /* ORA L */ \
+    X(0xb7, ORA(cpu, &cpu->a))           /* ORA A */ \
+    \
+    X(0xb6, ORA_M(cpu))                  /* ORA M */ \
+    \
+    X(0xf6, ORI(cpu))                    /* ORI D8 */ \
+    \
+    X(0xb8, CMP(cpu, &cpu->b))           /* CMP B */ \
+    X(0xb9, CMP(cpu, &cpu->c))           /* CMP C */ \
+    X(0xba, CMP(cpu, &cpu->d))           /* CMP D */ \
+    X(0xbb, CMP(cpu, &cpu->e))           /* CMP E */ \
+    X(0xbc, CMP(cpu, &cpu->h))           /* CMP H */ \
+    X(0xbd, CMP(cpu, &cpu->l))           /* CMP L */ \
+    X(0xbf, CMP(cpu, &cpu->a))           /* CMP A */ \
+    \
+    X(0xbe, CMP_M(cpu))                  /* CMP M */ \
+    \
+    X(0xfe, CPI(cpu))                    /* CPI D8 */ \
+    \
+    X(0x07, RLC(cpu))                    /* RLC */ \
+    X(0x0f, RRC(cpu))                    /* RRC */ \
+    X(0x17, RAL(cpu))                    /* RAL */ \
+    X(0x1f, RAR(cpu))                    /* RAR */ \
+    \
+    X(0x2f, CMA(cpu))                    /* CMA */ \
+    X(0x3f, CMC(cpu))                    /* CMC */ \
+    X(0x37, STC(cpu))                    /* STC */ \
+    \
+    X(0xc3, JMP(cpu))                    /* JMP addr */ \
+    X(0xcb, JMP(cpu))                    /* JMP addr (undocumented) */ \
+    X(0xc2, JNZ(cpu))                    /* JNZ addr */ \
+    X(0xca, JZ(cpu))                     /* JZ addr */ \
+    X(0xd2, JNC(cpu))                    /* JNC addr */ \
+    X(0xda, JC(cpu))                     /* JC addr */ \
+    X(0xe2, JPO(cpu))                    /* JPO addr */ \
+    X(0xea, JPE(cpu))                    /* JPE addr */ \
+    X(0xf2, JP(cpu))                     /* JP addr */ \
+    X(0xfa, JM(cpu))                     /* JM addr */ \
+    \
+    X(0xcd, CALL(cpu))                   /* CALL addr */ \
+    X(0xdd, CALL(cpu))                   /* CALL addr (undocumented) */ \
+    X(0xed, CALL(cpu))                   /* CALL addr (undocumented) */ \
+    X(0xfd, CALL(cpu))                   /* CALL addr (undocumented) */ \
+    X(0xc4, CNZ(cpu))                    /* CNZ addr */ \
+    X(0xcc, CZ(cpu))                     /* CZ addr */ \
+    X(0xd4, CNC(cpu))                    /* CNC addr */ \
+    X(0xdc, CC(cpu))                     /* CC addr */ \
+    X(0xe4, CPO(cpu))                    /* CPO addr */ \
+    X(0xec, CPE(cpu))                    /* CPE addr */ \
+    X(0xf4, CP(cpu))                     /* CP addr */ \
+    X(0xfc, CM(cpu))                     /* CM addr */ \
+    \
+    X(0xc9, RET(cpu))                    /* RET */ \
+    X(0xd9, RET(cpu))                    /* RET (undocumented) */ \
+    X(0xc0, RNZ(cpu))                    /* RNZ */ \
+    X(0xc8, RZ(cpu))                     /* RZ */ \
+    X(0xd0, RNC(cpu))                    /* RNC */ \
+    X(0xd8, RC(cpu))                     /* RC */ \
+    X(0xe0, RPO(cpu))                    /* RPO */ \
+    X(0xe8, RPE(cpu))                    /* RPE */ \
+    X(0xf0, RP(cpu))                     /* RP */ \
+    X(0xf8, RM(cpu))                     /* RM */ \
+    \
+    X(0xc7, RST(cpu, 0x00))              /* RST 0 */ \
+    X(0xcf, RST(cpu, 0x08))              /* RST 1 */ \
+    X(0xd7, RST(cpu, 0x10))              /* RST 2 */ \
+    X(0xdf, RST(cpu, 0x18))              /* RST 3 */ \
+    X(0xe7, RST(cpu, 0x20))              /* RST 4 */ \
+    X(0xef, RST(cpu, 0x28))              /* RST 5 */ \
+    X(0xf7, RST(cpu, 0x30))              /* RST 6 */ \
+    X(0xff, RST(cpu, 0x38))              /* RST 7 */ \
+    \
+    X(0xe9, PCHL(cpu))                   /* PCHL */ \
+    \
+    X(0xc5, PUSH_B(cpu))                 /* PUSH B */ \
+    X(0xd5, PUSH_D(cpu))                 /* PUSH D */ \
+    X(0xe5, PUSH_H(cpu))                 /* PUSH H */ \
+    \
+    X(0xf5, PUSH_PSW(cpu))               /* PUSH PSW */ \
+    \
+    X(0xc1, POP_B(cpu))                  /* POP B */ \
+    X(0xd1, POP_D(cpu))                  /* POP D */ \
+    X(0xe1, POP_H(cpu))                  /* POP H */ \
+    \
+    X(0xf1, POP_PSW(cpu))                /* POP PSW */ \
+    X(0xe3, XTHL(cpu))                   /* XTHL */ \
+    X(0xf9, SPHL(cpu))                   /* SPHL */ \
+    \
+    X(0xdb, IN(cpu))                     /* IN D8 */ \
+    X(0xd3, OUT(cpu))                    /* OUT D8 */ \
+    \
+    X(0xfb, EI(cpu))                     /* EI */ \
+    X(0xf3, DI(cpu))                     /* DI */ \
+    X(0x76, HLT(cpu))                    /* HLT */
+
+#if !defined(CPU_DISPATCH_SWITCH) && !defined(CPU_DISPATCH_TABLE) && !defined(__GNUC__)
+#define CPU_DISPATCH_TABLE
+#endif
+
+
+// One small function per opcode, so every entry of the table has the same type
+#define HANDLER(op, call) static int op_##op(struct cpu *cpu) { return call; }
+OPCODES(HANDLER)
+#undef HANDLER
+
+// Opcodes missing from OPCODES would be left as NULL
+static const cpu_handler_t handlers[256] = {
+#define ENTRY(op, call) [op] = op_##op,
+    OPCODES(ENTRY)
+#undef ENTRY
+};
+
+// Handler for an opcode, for execution engines built on top of this one.
+// The handler expects cpu->pc to point just past the opcode.
+cpu_handler_t cpu_handler(uint8_t op) {
+    return handlers[op];
+}
+
+
+#ifdef CPU_DISPATCH_SWITCH
+
+int cpu_run_instruction(struct cpu *cpu) {
+    switch (cpu->ir) {
+#define CASE(op, call) case op: return call;
+        OPCODES(CASE)
+#undef CASE
 
         default:
             return 0;
     }
 }
+
+#else
+
+int cpu_run_instruction(struct cpu *cpu) {
+    cpu_handler_t handler = handlers[cpu->ir];
+
+    return handler ? handler(cpu) : 0;
+}
+
+#endif
+
+
+/*
+ * Profiler
+ *
+ * Built with CPU_PROFILE, cpu_run() counts the executions and cycles of every
+ * opcode and every PC, and the totals are printed to stderr, sorted by
+ * cycles, when the program exits. Without it the hooks expand to nothing.
+ * Instructions run by the uop cache or the JIT are not counted, and counts
+ * from several threads may be lost.
+ */
+
+#ifdef CPU_PROFILE
+
+#define PROFILE_TOP_PCS 40
+
+static uint64_t profile_op_count[256];
+static uint64_t profile_op_cycles[256];
+static uint64_t profile_pc_count[0x10000];
+static uint64_t profile_pc_cycles[0x10000];
+static uint8_t profile_pc_op[0x10000];
+
+static void profile_count(uint16_t pc, uint8_t op, int cycles) {
+    profile_op_count[op]++;
+    profile_op_cycles[op] += cycles;
+    profile_pc_count[pc]++;
+    profile_pc_cycles[pc] += cycles;
+    profile_pc_op[pc] = op;
+}
+
+// Sort indices by descending cycles
+static const uint64_t *profile_sort_key;
+
+static int profile_compare(const void *a, const void *b) {
+    uint64_t x = profile_sort_key[*(const int *) a];
+    uint64_t y = profile_sort_key[*(const int *) b];
+    return (x < y) - (x > y);
+}
+
+__attribute__((destructor))
+static void profile_report() {
+    static int order[0x10000];
+    uint64_t total = 0;
+
+    for (int op = 0; op < 256; op++) {
+        total += profile_op_cycles[op];
+    }
+    if (!total) {
+        return;
+    }
+
+    for (int op = 0; op < 256; op++) {
+        order[op] = op;
+    }
+    profile_sort_key = profile_op_cycles;
+    qsort(order, 256, sizeof(int), profile_compare);
+
+    fprintf(stderr, "opcode  executions        cycles  cycles%%\n");
+    for (int i = 0; i < 256 && profile_op_count[order[i]]; i++) {
+        int op = order[i];
+        fprintf(stderr, "  0x%02x  %10llu  %12llu  %6.2f%%\n", op,
+                (unsigned long long) profile_op_count[op],
+                (unsigned long long) profile_op_cycles[op],
+                100.0 * profile_op_cycles[op] / total);
+    }
+
+    for (int pc = 0; pc < 0x10000; pc++) {
+        order[pc] = pc;
+    }
+    profile_sort_key = profile_pc_cycles;
+    qsort(order, 0x10000, sizeof(int), profile_compare);
+
+    fprintf(stderr, "\npc      opcode  executions        cycles  cycles%%\n");
+    for (int i = 0; i < PROFILE_TOP_PCS && profile_pc_count[order[i]]; i++) {
+        int pc = order[i];
+        fprintf(stderr, "0x%04x    0x%02x  %10llu  %12llu  %6.2f%%\n", pc, profile_pc_op[pc],
+                (unsigned long long) profile_pc_count[pc],
+                (unsigned long long) profile_pc_cycles[pc],
+                100.0 * profile_pc_cycles[pc] / total);
+    }
+}
+
+#define PROFILE_FETCH(cpu) profile_pc = (cpu)->pc
+#define PROFILE_COUNT(cpu, c) profile_count(profile_pc, (cpu)->ir, c)
+#define PROFILE_DECLARE uint16_t profile_pc = 0
+
+#else
+
+#define PROFILE_FETCH(cpu)
+#define PROFILE_COUNT(cpu, c)
+#define PROFILE_DECLARE
+
+#endif
+
+
+#if defined(CPU_DISPATCH_SWITCH) || defined(CPU_DISPATCH_TABLE)
+
+long cpu_run(struct cpu *cpu, long cycles) {
+    PROFILE_DECLARE;
+    long i = 0;
+    while (i < cycles) {
+        PROFILE_FETCH(cpu);
+        cpu_fetch(cpu);
+
+        int c;
+        if ((c = cpu_run_instruction(cpu))) {
+            PROFILE_COUNT(cpu, c);
+            i += c;
+        } else {
+            return -1;
+        }
+    }
+
+    return i;
+}
+
+#else
+
+long cpu_run(struct cpu *cpu, long cycles) {
+    static void *const labels[256] = {
+        [0 ... 255] = &&unimplemented,
+#define LABEL(op, call) [op] = &&op_##op,
+        OPCODES(LABEL)
+#undef LABEL
+    };
+
+    PROFILE_DECLARE;
+    long i = 0;
+
+    // Every handler ends with its own copy of this, which gives the branch
+    // predictor one indirect jump per opcode instead of a single shared one
+#define DISPATCH() \
+    if (i >= cycles) { return i; } \
+    PROFILE_FETCH(cpu); \
+    cpu_fetch(cpu); \
+    goto *labels[cpu->ir]
+
+    DISPATCH();
+
+#define BODY(op, call) op_##op: { int c = call; PROFILE_COUNT(cpu, c); i += c; } DISPATCH();
+    OPCODES(BODY)
+#undef BODY
+#undef DISPATCH
+
+unimplemented:
+    return -1;
+}
+
+#endif
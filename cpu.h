@@ -5,12 +5,13 @@
 
 #include "mem.h"
 
+// Flag masks, in their position in the status register
 typedef enum CF {
-    f_z  = 1,
-    f_s  = 1 << 1,
+    f_cy = 1,
     f_p  = 1 << 2,
-    f_cy = 1 << 3,
-    f_ac = 1 << 4
+    f_ac = 1 << 4,
+    f_z  = 1 << 6,
+    f_s  = 1 << 7
 } flag;
 
 #define F_ALL (f_z | f_s | f_p | f_cy | f_ac)
@@ -38,7 +39,7 @@ struct cpu {
                     uint8_t  p:1;   // Parity
                     uint8_t   :1;
                     uint8_t ac:1;   // Auxiliary Carry
-                    uint8_t  i:1;   // Interrupt
+                    uint8_t   :1;
                     uint8_t  z:1;   // Zero
                     uint8_t  s:1;   // Sign
                 } flags;
@@ -53,20 +54,28 @@ struct cpu {
             uint16_t af;
         };
     };
-    mem_t *mem;        // RAM
-    uint8_t ports[9];  // Ports
+    uint8_t inte;    // Interrupts enabled
+    uint8_t halted;  // Stopped by HLT
+    mem_t *mem;  // RAM
+
+    uint8_t (*in)(struct cpu *cpu, uint8_t port);               // IN handler
+    void (*out)(struct cpu *cpu, uint8_t port, uint8_t value);  // OUT handler
+
+    uint64_t instructions;  // Executed instructions
 };
 
-extern struct cpu cpu;
+typedef int (*cpu_handler_t)(struct cpu *cpu);
 
-void cpu_dump();
-void cpu_fetch();
-int cpu_run_instruction();
-void cpu_push(uint16_t value);
-uint16_t cpu_pop();
-void cpu_handle_flags(uint32_t result, size_t size, int flags);
-void cpu_read_bytes_to_wz();
-void cpu_read_byte_to_z();
+void cpu_dump(struct cpu *cpu);
+void cpu_fetch(struct cpu *cpu);
+int cpu_run_instruction(struct cpu *cpu);
+long cpu_run(struct cpu *cpu, long cycles);
+cpu_handler_t cpu_handler(uint8_t op);
+int cpu_length(uint8_t op);
+void cpu_push(struct cpu *cpu, uint16_t value);
+uint16_t cpu_pop(struct cpu *cpu);
+void cpu_read_bytes_to_wz(struct cpu *cpu);
+void cpu_read_byte_to_z(struct cpu *cpu);
 
 
 #endif
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disassembler.h"
+#include "flow.h"
+
+#define ROM_SIZE 0x2000  // Space Invaders ROM
+#define MAX_ENTRIES 64
+
+static uint8_t rom[ROM_SIZE + 2];  // Room for the operands of an instruction cut off at the end
+static char text[ROM_SIZE][DISASM_SIZE];
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Address, bytes, instruction and cycles (if the condition fails/holds for
+// conditional ones)
+static void print_instruction(int addr) {
+    const disasm_op_t *op = &disasm_ops[rom[addr]];
+
+    printf("%04x ", addr);
+    for (int i = 0; i < 3; i++) {
+        i < op->length ? printf(" %02x", rom[addr + i]) : printf("   ");
+    }
+    printf("  %-14s ; %d", text[addr], op->cycles);
+    if (op->cycles_taken != op->cycles) {
+        printf("/%d", op->cycles_taken);
+    }
+    putchar('\n');
+}
+
+
+// Every instruction from the start, as if the whole ROM was code
+static void list_linear(int size) {
+    double start = now();
+    for (int addr = 0; addr < size; ) {
+        addr += disasm(&rom[addr], text[addr], DISASM_SIZE, NULL);
+    }
+    double elapsed = now() - start;
+
+    for (int addr = 0; addr < size; addr += disasm_ops[rom[addr]].length) {
+        print_instruction(addr);
+    }
+
+    fprintf(stderr, "%d bytes disassembled in %.1f us\n", size, elapsed * 1e6);
+}
+
+
+// Only code reached from the entries, block by block
+static void list_flow(int size, const uint16_t *entries, int entry_count) {
+    double start = now();
+    flow_t *flow = flow_analyze(rom, size, entries, entry_count);
+    double elapsed = now() - start;
+
+    int code = 0;
+    int end = 0;
+    for (int i = 0; i < flow->block_count; i++) {
+        const flow_block_t *b = &flow->blocks[i];
+
+        if (b->start > end) {
+            int n = b->start - end;
+            printf("\n; %04x-%04x: %d byte%s not reached\n", end, b->start, n, n == 1 ? "" : "s");
+        }
+        if (flow->flags[b->start] & FLOW_FUNCTION) {
+            printf("\n; ---- function %04x\n", b->start);
+        }
+
+        printf("\n; block %04x-%04x of %04x", b->start, b->end, b->function);
+        if (b->flags & FLOW_TARGET) {
+            printf(", %s %04x%s", b->flags & FLOW_CALL ? "calls" : "jumps to", b->target,
+                    b->target >= size ? " (out of ROM)" : "");
+        }
+        if (b->flags & FLOW_NEXT) {
+            printf(", goes on to %04x", b->end);
+        }
+        if (b->flags & FLOW_INDIRECT) {
+            printf(", PCHL to an unknown target");
+        }
+        putchar('\n');
+
+        for (int addr = b->start; addr < b->end; addr += disasm_ops[rom[addr]].length) {
+            disasm(&rom[addr], text[addr], DISASM_SIZE, NULL);
+            print_instruction(addr);
+        }
+
+        code += b->end - b->start;
+        end = b->end > end ? b->end : end;
+    }
+
+    for (int i = 0; i < flow->indirect_count; i++) {
+        fprintf(stderr, "PCHL at %04x: target unknown, add it with -e once found\n",
+                flow->indirect[i]);
+    }
+    fprintf(stderr, "%d functions, %d blocks, %d of %d bytes of code, "
+            "%d exits out of ROM, %d overlapping instructions, analyzed in %.1f us\n",
+            flow->function_count, flow->block_count, code, size,
+            flow->external, flow->overlaps, elapsed * 1e6);
+
+    flow_free(flow);
+}
+
+
+static void usage(const char *name) {
+    printf("Usage: %s [-f] [-e addr]... rom\n", name);
+    puts("");
+    puts("Lists a ROM one instruction a line. -f lists only the code reached from");
+    puts("the reset and interrupt vectors (0000, 0008 and 0010) and each -e entry");
+    puts("point (hex), cut into functions and basic blocks.");
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    int flow = 0;
+    uint16_t entries[MAX_ENTRIES] = { 0x0000, 0x0008, 0x0010 };
+    int entry_count = 3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "fe:h")) != -1) {
+        switch (opt) {
+            case 'f': flow = 1; break;
+            case 'e':
+                if (entry_count == MAX_ENTRIES) {
+                    usage(argv[0]);
+                }
+                entries[entry_count++] = strtol(optarg, NULL, 16);
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+        printf("Could not open ROM: %s\n", argv[optind]);
+        return 1;
+    }
+    int size = fread(rom, 1, ROM_SIZE, f);
+    fclose(f);
+
+    if (flow) {
+        list_flow(size, entries, entry_count);
+    } else {
+        list_linear(size);
+    }
+
+    return 0;
+}
@@ -1,262 +1,324 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <assert.h>
 
-void disassemble(const uint8_t *code) {
-    switch (*code) {
-        case 0x00: printf("NOP"); break;
-        case 0x01: printf("LXI B, %02x%02x", code[2], code[1]); break;
-        case 0x02: printf("STAX B"); break;
-        case 0x03: printf("INX B"); break;
-        case 0x04: printf("INR B"); break;
-        case 0x05: printf("DCR B"); break;
-        case 0x06: printf("MVI B, %02x", code[1]); break;
-        case 0x07: printf("RLC"); break;
-        case 0x08: printf("-"); break;
-        case 0x09: printf("DAD B"); break;
-        case 0x0a: printf("LDAX B"); break;
-        case 0x0b: printf("DCX B"); break;
-        case 0x0c: printf("INR C"); break;
-        case 0x0d: printf("DCR C"); break;
-        case 0x0e: printf("MVI C, %02x", code[1]); break;
-        case 0x0f: printf("RRC"); break;
-        case 0x10: printf("-"); break;
-        case 0x11: printf("LXI D, %02x%02x", code[2], code[1]); break;
-        case 0x12: printf("STAX D"); break;
-        case 0x13: printf("INX D"); break;
-        case 0x14: printf("INR D"); break;
-        case 0x15: printf("DCR D"); break;
-        case 0x16: printf("MVI D, %02x",code[1]); break;
-        case 0x17: printf("RAL"); break;
-        case 0x18: printf("-"); break;
-        case 0x19: printf("DAD D"); break;
-        case 0x1a: printf("LDAX D"); break;
-        case 0x1b: printf("DCX D"); break;
-        case 0x1c: printf("INR E"); break;
-        case 0x1d: printf("DCR E"); break;
-        case 0x1e: printf("MVI E, %02x", code[1]); break;
-        case 0x1f: printf("RAR"); break;
-        case 0x20: printf("RIM"); break;
-        case 0x21: printf("LXI H, %02x%02x", code[2], code[1]); break;
-        case 0x22: printf("SHLD %02x%02x", code[2], code[1]); break;
-        case 0x23: printf("INX H"); break;
-        case 0x24: printf("INR H"); break;
-        case 0x25: printf("DCR H"); break;
-        case 0x26: printf("MVI H, %02x", code[1]); break;
-        case 0x27: printf("DAA"); break;
-        case 0x28: printf("-"); break;
-        case 0x29: printf("DAD H"); break;
-        case 0x2a: printf("LHLD %02x%02x", code[2], code[1]); break;
-        case 0x2b: printf("DCX H"); break;
-        case 0x2c: printf("INR L"); break;
-        case 0x2d: printf("DCR L"); break;
-        case 0x2e: printf("MVI L, %02x", code[1]); break;
-        case 0x2f: printf("CMA"); break;
-        case 0x30: printf("SIM"); break;
-        case 0x31: printf("LXI SP, %02x%02x", code[2], code[1]); break;
-        case 0x32: printf("STA %02x%02x", code[2], code[1]); break;
-        case 0x33: printf("INX SP"); break;
-        case 0x34: printf("INR M"); break;
-        case 0x35: printf("DCR M"); break;
-        case 0x36: printf("MVI M, %02x", code[1]); break;
-        case 0x37: printf("STC"); break;
-        case 0x38: printf("-"); break;
-        case 0x39: printf("DAD SP"); break;
-        case 0x3a: printf("LDA %02x%02x", code[2], code[1]); break;
-        case 0x3b: printf("DCX SP"); break;
-        case 0x3c: printf("INR A"); break;
-        case 0x3d: printf("DCR A"); break;
-        case 0x3e: printf("MVI A, %02x", code[1]); break;
-        case 0x3f: printf("CMC"); break;
-        case 0x40: printf("MOV B, B"); break;
-        case 0x41: printf("MOV B, C"); break;
-        case 0x42: printf("MOV B, D"); break;
-        case 0x43: printf("MOV B, E"); break;
-        case 0x44: printf("MOV B, H"); break;
-        case 0x45: printf("MOV B, L"); break;
-        case 0x46: printf("MOV B, M"); break;
-        case 0x47: printf("MOV B, A"); break;
-        case 0x48: printf("MOV C, B"); break;
-        case 0x49: printf("MOV C, C"); break;
-        case 0x4a: printf("MOV C, D"); break;
-        case 0x4b: printf("MOV C, E"); break;
-        case 0x4c: printf("MOV C, H"); break;
-        case 0x4d: printf("MOV C, L"); break;
-        case 0x4e: printf("MOV C, M"); break;
-        case 0x4f: printf("MOV C, A"); break;
-        case 0x50: printf("MOV D, B"); break;
-        case 0x51: printf("MOV D, C"); break;
-        case 0x52: printf("MOV D, D"); break;
-        case 0x53: printf("MOV D, E"); break;
-        case 0x54: printf("MOV D, H"); break;
-        case 0x55: printf("MOV D, L"); break;
-        case 0x56: printf("MOV D, M"); break;
-        case 0x57: printf("MOV D, A"); break;
-        case 0x58: printf("MOV E, B"); break;
-        case 0x59: printf("MOV E, C"); break;
-        case 0x5a: printf("MOV E, D"); break;
-        case 0x5b: printf("MOV E, E"); break;
-        case 0x5c: printf("MOV E, H"); break;
-        case 0x5d: printf("MOV E, L"); break;
-        case 0x5e: printf("MOV E, M"); break;
-        case 0x5f: printf("MOV E, A"); break;
-        case 0x60: printf("MOV H, B"); break;
-        case 0x61: printf("MOV H, C"); break;
-        case 0x62: printf("MOV H, D"); break;
-        case 0x63: printf("MOV H, E"); break;
-        case 0x64: printf("MOV H, H"); break;
-        case 0x65: printf("MOV H, L"); break;
-        case 0x66: printf("MOV H, M"); break;
-        case 0x67: printf("MOV H, A"); break;
-        case 0x68: printf("MOV L, B"); break;
-        case 0x69: printf("MOV L, C"); break;
-        case 0x6a: printf("MOV L, D"); break;
-        case 0x6b: printf("MOV L, E"); break;
-        case 0x6c: printf("MOV L, H"); break;
-        case 0x6d: printf("MOV L, L"); break;
-        case 0x6f: printf("MOV L, A"); break;
-        case 0x70: printf("MOV M, B"); break;
-        case 0x71: printf("MOV M, C"); break;
-        case 0x72: printf("MOV M, D"); break;
-        case 0x73: printf("MOV M, E"); break;
-        case 0x74: printf("MOV M, H"); break;
-        case 0x75: printf("MOV M, L"); break;
-        case 0x76: printf("HLT"); break;
-        case 0x77: printf("MOV M, A"); break;
-        case 0x78: printf("MOV A, B"); break;
-        case 0x79: printf("MOV A, C"); break;
-        case 0x7a: printf("MOV A, D"); break;
-        case 0x7b: printf("MOV A, E"); break;
-        case 0x7c: printf("MOV A, H"); break;
-        case 0x7d: printf("MOV A, L"); break;
-        case 0x7e: printf("MOV A, M"); break;
-        case 0x7f: printf("MOV A, A"); break;
-        case 0x80: printf("ADD B"); break;
-        case 0x81: printf("ADD C"); break;
-        case 0x82: printf("ADD D"); break;
-        case 0x83: printf("ADD E"); break;
-        case 0x84: printf("ADD H"); break;
-        case 0x85: printf("ADD L"); break;
-        case 0x86: printf("ADD M"); break;
-        case 0x87: printf("ADD A"); break;
-        case 0x88: printf("ADC B"); break;
-        case 0x89: printf("ADC C"); break;
-        case 0x8a: printf("ADC D"); break;
-        case 0x8b: printf("ADC E"); break;
-        case 0x8c: printf("ADC H"); break;
-        case 0x8d: printf("ADC L"); break;
-        case 0x8e: printf("ADC M"); break;
-        case 0x8f: printf("ADC A"); break;
-        case 0x90: printf("SUB B"); break;
-        case 0x91: printf("SUB C"); break;
-        case 0x92: printf("SUB D"); break;
-        case 0x93: printf("SUB E"); break;
-        case 0x94: printf("SUB H"); break;
-        case 0x95: printf("SUB L"); break;
-        case 0x96: printf("SUB M"); break;
-        case 0x97: printf("SUB A"); break;
-        case 0x98: printf("SBB B"); break;
-        case 0x99: printf("SBB C"); break;
-        case 0x9a: printf("SBB D"); break;
-        case 0x9b: printf("SBB E"); break;
-        case 0x9c: printf("SBB H"); break;
-        case 0x9d: printf("SBB L"); break;
-        case 0x9e: printf("SBB M"); break;
-        case 0x9f: printf("SBB A"); break;
-        case 0xa0: printf("ANA B"); break;
-        case 0xa1: printf("ANA C"); break;
-        case 0xa2: printf("ANA D"); break;
-        case 0xa3: printf("ANA E"); break;
-        case 0xa4: printf("ANA H"); break;
-        case 0xa5: printf("ANA L"); break;
-        case 0xa6: printf("ANA M"); break;
-        case 0xa7: printf("ANA A"); break;
-        case 0xa8: printf("XRA B"); break;
-        case 0xa9: printf("XRA C"); break;
-        case 0xaa: printf("XRA D"); break;
-        case 0xab: printf("XRA E"); break;
-        case 0xac: printf("XRA H"); break;
-        case 0xad: printf("XRA L"); break;
-        case 0xae: printf("XRA M"); break;
-        case 0xaf: printf("XRA A"); break;
-        case 0xb0: printf("ORA B"); break;
-        case 0xb1: printf("ORA C"); break;
-        case 0xb2: printf("ORA D"); break;
-        case 0xb3: printf("ORA E"); break;
-        case 0xb4: printf("ORA H"); break;
-        case 0xb5: printf("ORA L"); break;
-        case 0xb6: printf("ORA M"); break;
-        case 0xb7: printf("ORA A"); break;
-        case 0xb8: printf("CMP B"); break;
-        case 0xb9: printf("CMP C"); break;
-        case 0xba: printf("CMP D"); break;
-        case 0xbb: printf("CMP E"); break;
-        case 0xbc: printf("CMP H"); break;
-        case 0xbd: printf("CMP L"); break;
-        case 0xbe: printf("CMP M"); break;
-        case 0xbf: printf("CMP A"); break;
-        case 0xc0: printf("RNZ"); break;
-        case 0xc1: printf("POP B"); break;
-        case 0xc2: printf("JNZ %02x%02x", code[2], code[1]); break;
-        case 0xc3: printf("JMP %02x%02x", code[2], code[1]); break;
-        case 0xc4: printf("CNZ %02x%02x", code[2], code[1]); break;
-        case 0xc5: printf("PUSH B"); break;
-        case 0xc6: printf("ADI %02x", code[1]); break;
-        case 0xc7: printf("RST 0"); break;
-        case 0xc8: printf("RZ"); break;
-        case 0xc9: printf("RET"); break;
-        case 0xca: printf("JZ %02x%02x", code[2], code[1]); break;
-        case 0xcb: printf("-"); break;
-        case 0xcc: printf("CZ %02x%02x", code[2], code[1]); break;
-        case 0xcd: printf("CALL %02x%02x", code[2], code[1]); break;
-        case 0xce: printf("ACI %02x", code[1]); break;
-        case 0xcf: printf("RST 1"); break;
-        case 0xd0: printf("RNC"); break;
-        case 0xd1: printf("POP D"); break;
-        case 0xd2: printf("JNC %02x%02x", code[2], code[1]); break;
-        case 0xd3: printf("OUT %02x", code[1]); break;
-        case 0xd4: printf("CNC %02x%02x", code[2], code[1]); break;
-        case 0xd5: printf("PUSH D"); break;
-        case 0xd6: printf("SUI %02x", code[1]); break;
-        case 0xd7: printf("RST 2"); break;
-        case 0xd8: printf("RC"); break;
-        case 0xd9: printf("-"); break;
-        case 0xda: printf("JC %02x%02x", code[2], code[1]); break;
-        case 0xdb: printf("IN %02x", code[1]); break;
-        case 0xdc: printf("CC %02x%02x", code[2], code[1]); break;
-        case 0xdd: printf("-"); break;
-        case 0xde: printf("SBI %02x", code[1]); break;
-        case 0xdf: printf("RST 3"); break;
-        case 0xe0: printf("RPO"); break;
-        case 0xe1: printf("POP H"); break;
-        case 0xe2: printf("JPO %02x%02x", code[2], code[1]); break;
-        case 0xe3: printf("XTHL"); break;
-        case 0xe4: printf("CPO %02x%02x", code[2], code[1]); break;
-        case 0xe5: printf("PUSH H"); break;
-        case 0xe6: printf("ANI %02x", code[1]); break;
-        case 0xe7: printf("RST 4"); break;
-        case 0xe8: printf("RPE"); break;
-        case 0xe9: printf("PCHL"); break;
-        case 0xea: printf("JPE %02x%02x", code[2], code[1]); break;
-        case 0xeb: printf("XCHG"); break;
-        case 0xec: printf("CPE %02x%02x", code[2], code[1]); break;
-        case 0xed: printf("-"); break;
-        case 0xee: printf("XRI %02x", code[1]); break;
-        case 0xef: printf("RST 5"); break;
-        case 0xf0: printf("RP"); break;
-        case 0xf1: printf("POP PSW"); break;
-        case 0xf2: printf("JP %02x%02x", code[2], code[1]); break;
-        case 0xf3: printf("DI"); break;
-        case 0xf4: printf("CA %02x%02x", code[2], code[1]); break;
-        case 0xf5: printf("PUSH PSW"); break;
-        case 0xf6: printf("ORI %02x", code[1]); break;
-        case 0xf7: printf("RST 6");
-        case 0xf8: printf("RM"); break;
-        case 0xf9: printf("SPHL"); break;
-        case 0xfa: printf("JM %02x%02x", code[2], code[1]); break;
-        case 0xfb: printf("EI"); break;
-        case 0xfc: printf("CM %02x%02x", code[2], code[1]); break;
-        case 0xfd: printf("-"); break;
-        case 0xfe: printf("CPI %02x", code[1]); break;
-        case 0xff: printf("RST 7"); break;
+#include "disassembler.h"
+
+// Short names for the table
+#define NEXT DISASM_NEXT
+#define JUMP DISASM_JUMP
+#define BRANCH DISASM_BRANCH
+#define CALL DISASM_CALL
+#define RST DISASM_RST
+#define RETURN DISASM_RETURN
+#define COND_RETURN DISASM_COND_RETURN
+#define PCHL DISASM_PCHL
+#define HALT DISASM_HALT
+
+/*
+ * Opcode table
+ *
+ * Text, its length, bytes, cycles, cycles when the condition holds and how
+ * control leaves. This is the one place the interpreter, the translators and
+ * the flow analysis learn instruction lengths from; cpm checks the cycles
+ * against the interpreter when it starts.
+ * Operands are not part of the text: instructions two or three bytes long
+ * get their immediate byte or word appended in hex. The undocumented opcodes
+ * decode as the instructions the CPU runs for them.
+ */
+
+const disasm_op_t disasm_ops[256] = {
+    [0x00] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x01] = { "LXI B, ",   7, 3, 10, 10, NEXT },
+    [0x02] = { "STAX B",    6, 1,  7,  7, NEXT },
+    [0x03] = { "INX B",     5, 1,  5,  5, NEXT },
+    [0x04] = { "INR B",     5, 1,  5,  5, NEXT },
+    [0x05] = { "DCR B",     5, 1,  5,  5, NEXT },
+    [0x06] = { "MVI B, ",   7, 2,  7,  7, NEXT },
+    [0x07] = { "RLC",       3, 1,  4,  4, NEXT },
+    [0x08] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x09] = { "DAD B",     5, 1, 10, 10, NEXT },
+    [0x0a] = { "LDAX B",    6, 1,  7,  7, NEXT },
+    [0x0b] = { "DCX B",     5, 1,  5,  5, NEXT },
+    [0x0c] = { "INR C",     5, 1,  5,  5, NEXT },
+    [0x0d] = { "DCR C",     5, 1,  5,  5, NEXT },
+    [0x0e] = { "MVI C, ",   7, 2,  7,  7, NEXT },
+    [0x0f] = { "RRC",       3, 1,  4,  4, NEXT },
+    [0x10] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x11] = { "LXI D, ",   7, 3, 10, 10, NEXT },
+    [0x12] = { "STAX D",    6, 1,  7,  7, NEXT },
+    [0x13] = { "INX D",     5, 1,  5,  5, NEXT },
+    [0x14] = { "INR D",     5, 1,  5,  5, NEXT },
+    [0x15] = { "DCR D",     5, 1,  5,  5, NEXT },
+    [0x16] = { "MVI D, ",   7, 2,  7,  7, NEXT },
+    [0x17] = { "RAL",       3, 1,  4,  4, NEXT },
+    [0x18] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x19] = { "DAD D",     5, 1, 10, 10, NEXT },
+    [0x1a] = { "LDAX D",    6, 1,  7,  7, NEXT },
+    [0x1b] = { "DCX D",     5, 1,  5,  5, NEXT },
+    [0x1c] = { "INR E",     5, 1,  5,  5, NEXT },
+    [0x1d] = { "DCR E",     5, 1,  5,  5, NEXT },
+    [0x1e] = { "MVI E, ",   7, 2,  7,  7, NEXT },
+    [0x1f] = { "RAR",       3, 1,  4,  4, NEXT },
+    [0x20] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x21] = { "LXI H, ",   7, 3, 10, 10, NEXT },
+    [0x22] = { "SHLD ",     5, 3, 16, 16, NEXT },
+    [0x23] = { "INX H",     5, 1,  5,  5, NEXT },
+    [0x24] = { "INR H",     5, 1,  5,  5, NEXT },
+    [0x25] = { "DCR H",     5, 1,  5,  5, NEXT },
+    [0x26] = { "MVI H, ",   7, 2,  7,  7, NEXT },
+    [0x27] = { "DAA",       3, 1,  4,  4, NEXT },
+    [0x28] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x29] = { "DAD H",     5, 1, 10, 10, NEXT },
+    [0x2a] = { "LHLD ",     5, 3, 16, 16, NEXT },
+    [0x2b] = { "DCX H",     5, 1,  5,  5, NEXT },
+    [0x2c] = { "INR L",     5, 1,  5,  5, NEXT },
+    [0x2d] = { "DCR L",     5, 1,  5,  5, NEXT },
+    [0x2e] = { "MVI L, ",   7, 2,  7,  7, NEXT },
+    [0x2f] = { "CMA",       3, 1,  4,  4, NEXT },
+    [0x30] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x31] = { "LXI SP, ",  8, 3, 10, 10, NEXT },
+    [0x32] = { "STA ",      4, 3, 13, 13, NEXT },
+    [0x33] = { "INX SP",    6, 1,  5,  5, NEXT },
+    [0x34] = { "INR M",     5, 1, 10, 10, NEXT },
+    [0x35] = { "DCR M",     5, 1, 10, 10, NEXT },
+    [0x36] = { "MVI M, ",   7, 2, 10, 10, NEXT },
+    [0x37] = { "STC",       3, 1,  4,  4, NEXT },
+    [0x38] = { "NOP",       3, 1,  4,  4, NEXT },
+    [0x39] = { "DAD SP",    6, 1, 10, 10, NEXT },
+    [0x3a] = { "LDA ",      4, 3, 13, 13, NEXT },
+    [0x3b] = { "DCX SP",    6, 1,  5,  5, NEXT },
+    [0x3c] = { "INR A",     5, 1,  5,  5, NEXT },
+    [0x3d] = { "DCR A",     5, 1,  5,  5, NEXT },
+    [0x3e] = { "MVI A, ",   7, 2,  7,  7, NEXT },
+    [0x3f] = { "CMC",       3, 1,  4,  4, NEXT },
+    [0x40] = { "MOV B, B",  8, 1,  5,  5, NEXT },
+    [0x41] = { "MOV B, C",  8, 1,  5,  5, NEXT },
+    [0x42] = { "MOV B, D",  8, 1,  5,  5, NEXT },
+    [0x43] = { "MOV B, E",  8, 1,  5,  5, NEXT },
+    [0x44] = { "MOV B, H",  8, 1,  5,  5, NEXT },
+    [0x45] = { "MOV B, L",  8, 1,  5,  5, NEXT },
+    [0x46] = { "MOV B, M",  8, 1,  7,  7, NEXT },
+    [0x47] = { "MOV B, A",  8, 1,  5,  5, NEXT },
+    [0x48] = { "MOV C, B",  8, 1,  5,  5, NEXT },
+    [0x49] = { "MOV C, C",  8, 1,  5,  5, NEXT },
+    [0x4a] = { "MOV C, D",  8, 1,  5,  5, NEXT },
+    [0x4b] = { "MOV C, E",  8, 1,  5,  5, NEXT },
+    [0x4c] = { "MOV C, H",  8, 1,  5,  5, NEXT },
+    [0x4d] = { "MOV C, L",  8, 1,  5,  5, NEXT },
+    [0x4e] = { "MOV C, M",  8, 1,  7,  7, NEXT },
+    [0x4f] = { "MOV C, A",  8, 1,  5,  5, NEXT },
+    [0x50] = { "MOV D, B",  8, 1,  5,  5, NEXT },
+    [0x51] = { "MOV D, C",  8, 1,  5,  5, NEXT },
+    [0x52] = { "MOV D, D",  8, 1,  5,  5, NEXT },
+    [0x53] = { "MOV D, E",  8, 1,  5,  5, NEXT },
+    [0x54] = { "MOV D, H",  8, 1,  5,  5, NEXT },
+    [0x55] = { "MOV D, L",  8, 1,  5,  5, NEXT },
+    [0x56] = { "MOV D, M",  8, 1,  7,  7, NEXT },
+    [0x57] = { "MOV D, A",  8, 1,  5,  5, NEXT },
+    [0x58] = { "MOV E, B",  8, 1,  5,  5, NEXT },
+    [0x59] = { "MOV E, C",  8, 1,  5,  5, NEXT },
+    [0x5a] = { "MOV E, D",  8, 1,  5,  5, NEXT },
+    [0x5b] = { "MOV E, E",  8, 1,  5,  5, NEXT },
+    [0x5c] = { "MOV E, H",  8, 1,  5,  5, NEXT },
+    [0x5d] = { "MOV E, L",  8, 1,  5,  5, NEXT },
+    [0x5e] = { "MOV E, M",  8, 1,  7,  7, NEXT },
+    [0x5f] = { "MOV E, A",  8, 1,  5,  5, NEXT },
+    [0x60] = { "MOV H, B",  8, 1,  5,  5, NEXT },
+    [0x61] = { "MOV H, C",  8, 1,  5,  5, NEXT },
+    [0x62] = { "MOV H, D",  8, 1,  5,  5, NEXT },
+    [0x63] = { "MOV H, E",  8, 1,  5,  5, NEXT },
+    [0x64] = { "MOV H, H",  8, 1,  5,  5, NEXT },
+    [0x65] = { "MOV H, L",  8, 1,  5,  5, NEXT },
+    [0x66] = { "MOV H, M",  8, 1,  7,  7, NEXT },
+    [0x67] = { "MOV H, A",  8, 1,  5,  5, NEXT },
+    [0x68] = { "MOV L, B",  8, 1,  5,  5, NEXT },
+    [0x69] = { "MOV L, C",  8, 1,  5,  5, NEXT },
+    [0x6a] = { "MOV L, D",  8, 1,  5,  5, NEXT },
+    [0x6b] = { "MOV L, E",  8, 1,  5,  5, NEXT },
+    [0x6c] = { "MOV L, H",  8, 1,  5,  5, NEXT },
+    [0x6d] = { "MOV L, L",  8, 1,  5,  5, NEXT },
+    [0x6e] = { "MOV L, M",  8, 1,  7,  7, NEXT },
+    [0x6f] = { "MOV L, A",  8, 1,  5,  5, NEXT },
+    [0x70] = { "MOV M, B",  8, 1,  7,  7, NEXT },
+    [0x71] = { "MOV M, C",  8, 1,  7,  7, NEXT },
+    [0x72] = { "MOV M, D",  8, 1,  7,  7, NEXT },
+    [0x73] = { "MOV M, E",  8, 1,  7,  7, NEXT },
+    [0x74] = { "MOV M, H",  8, 1,  7,  7, NEXT },
+    [0x75] = { "MOV M, L",  8, 1,  7,  7, NEXT },
+    [0x76] = { "HLT",       3, 1,  7,  7, HALT },
+    [0x77] = { "MOV M, A",  8, 1,  7,  7, NEXT },
+    [0x78] = { "MOV A, B",  8, 1,  5,  5, NEXT },
+    [0x79] = { "MOV A, C",  8, 1,  5,  5, NEXT },
+    [0x7a] = { "MOV A, D",  8, 1,  5,  5, NEXT },
+    [0x7b] = { "MOV A, E",  8, 1,  5,  5, NEXT },
+    [0x7c] = { "MOV A, H",  8, 1,  5,  5, NEXT },
+    [0x7d] = { "MOV A, L",  8, 1,  5,  5, NEXT },
+    [0x7e] = { "MOV A, M",  8, 1,  7,  7, NEXT },
+    [0x7f] = { "MOV A, A",  8, 1,  5,  5, NEXT },
+    [0x80] = { "ADD B",     5, 1,  4,  4, NEXT },
+    [0x81] = { "ADD C",     5, 1,  4,  4, NEXT },
+    [0x82] = { "ADD D",     5, 1,  4,  4, NEXT },
+    [0x83] = { "ADD E",     5, 1,  4,  4, NEXT },
+    [0x84] = { "ADD H",     5, 1,  4,  4, NEXT },
+    [0x85] = { "ADD L",     5, 1,  4,  4, NEXT },
+    [0x86] = { "ADD M",     5, 1,  7,  7, NEXT },
+    [0x87] = { "ADD A",     5, 1,  4,  4, NEXT },
+    [0x88] = { "ADC B",     5, 1,  4,  4, NEXT },
+    [0x89] = { "ADC C",     5, 1,  4,  4, NEXT },
+    [0x8a] = { "ADC D",     5, 1,  4,  4, NEXT },
+    [0x8b] = { "ADC E",     5, 1,  4,  4, NEXT },
+    [0x8c] = { "ADC H",     5, 1,  4,  4, NEXT },
+    [0x8d] = { "ADC L",     5, 1,  4,  4, NEXT },
+    [0x8e] = { "ADC M",     5, 1,  7,  7, NEXT },
+    [0x8f] = { "ADC A",     5, 1,  4,  4, NEXT },
+    [0x90] = { "SUB B",     5, 1,  4,  4, NEXT },
+    [0x91] = { "SUB C",     5, 1,  4,  4, NEXT },
+    [0x92] = { "SUB D",     5, 1,  4,  4, NEXT },
+    [0x93] = { "SUB E",     5, 1,  4,  4, NEXT },
+    [0x94] = { "SUB H",     5, 1,  4,  4, NEXT },
+    [0x95] = { "SUB L",     5, 1,  4,  4, NEXT },
+    [0x96] = { "SUB M",     5, 1,  7,  7, NEXT },
+    [0x97] = { "SUB A",     5, 1,  4,  4, NEXT },
+    [0x98] = { "SBB B",     5, 1,  4,  4, NEXT },
+    [0x99] = { "SBB C",     5, 1,  4,  4, NEXT },
+    [0x9a] = { "SBB D",     5, 1,  4,  4, NEXT },
+    [0x9b] = { "SBB E",     5, 1,  4,  4, NEXT },
+    [0x9c] = { "SBB H",     5, 1,  4,  4, NEXT },
+    [0x9d] = { "SBB L",     5, 1,  4,  4, NEXT },
+    [0x9e] = { "SBB M",     5, 1,  7,  7, NEXT },
+    [0x9f] = { "SBB A",     5, 1,  4,  4, NEXT },
+    [0xa0] = { "ANA B",     5, 1,  4,  4, NEXT },
+    [0xa1] = { "ANA C",     5, 1,  4,  4, NEXT },
+    [0xa2] = { "ANA D",     5, 1,  4,  4, NEXT },
+    [0xa3] = { "ANA E",     5, 1,  4,  4, NEXT },
+    [0xa4] = { "ANA H",     5, 1,  4,  4, NEXT },
+    [0xa5] = { "ANA L",     5, 1,  4,  4, NEXT },
+    [0xa6] = { "ANA M",     5, 1,  7,  7, NEXT },
+    [0xa7] = { "ANA A",     5, 1,  4,  4, NEXT },
+    [0xa8] = { "XRA B",     5, 1,  4,  4, NEXT },
+    [0xa9] = { "XRA C",     5, 1,  4,  4, NEXT },
+    [0xaa] = { "XRA D",     5, 1,  4,  4, NEXT },
+    [0xab] = { "XRA E",     5, 1,  4,  4, NEXT },
+    [0xac] = { "XRA H",     5, 1,  4,  4, NEXT },
+    [0xad] = { "XRA L",     5, 1,  4,  4, NEXT },
+    [0xae] = { "XRA M",     5, 1,  7,  7, NEXT },
+    [0xaf] = { "XRA A",     5, 1,  4,  4, NEXT },
+    [0xb0] = { "ORA B",     5, 1,  4,  4, NEXT },
+    [0xb1] = { "ORA C",     5, 1,  4,  4, NEXT },
+    [0xb2] = { "ORA D",     5, 1,  4,  4, NEXT },
+    [0xb3] = { "ORA E",     5, 1,  4,  4, NEXT },
+    [0xb4] = { "ORA H",     5, 1,  4,  4, NEXT },
+    [0xb5] = { "ORA L",     5, 1,  4,  4, NEXT },
+    [0xb6] = { "ORA M",     5, 1,  7,  7, NEXT },
+    [0xb7] = { "ORA A",     5, 1,  4,  4, NEXT },
+    [0xb8] = { "CMP B",     5, 1,  4,  4, NEXT },
+    [0xb9] = { "CMP C",     5, 1,  4,  4, NEXT },
+    [0xba] = { "CMP D",     5, 1,  4,  4, NEXT },
+    [0xbb] = { "CMP E",     5, 1,  4,  4, NEXT },
+    [0xbc] = { "CMP H",     5, 1,  4,  4, NEXT },
+    [0xbd] = { "CMP L",     5, 1,  4,  4, NEXT },
+    [0xbe] = { "CMP M",     5, 1,  7,  7, NEXT },
+    [0xbf] = { "CMP A",     5, 1,  4,  4, NEXT },
+    [0xc0] = { "RNZ",       3, 1,  5, 11, COND_RETURN },
+    [0xc1] = { "POP B",     5, 1, 10, 10, NEXT },
+    [0xc2] = { "JNZ ",      4, 3, 10, 10, BRANCH },
+    [0xc3] = { "JMP ",      4, 3, 10, 10, JUMP },
+    [0xc4] = { "CNZ ",      4, 3, 11, 17, CALL },
+    [0xc5] = { "PUSH B",    6, 1, 11, 11, NEXT },
+    [0xc6] = { "ADI ",      4, 2,  7,  7, NEXT },
+    [0xc7] = { "RST 0",     5, 1, 11, 11, RST },
+    [0xc8] = { "RZ",        2, 1,  5, 11, COND_RETURN },
+    [0xc9] = { "RET",       3, 1, 10, 10, RETURN },
+    [0xca] = { "JZ ",       3, 3, 10, 10, BRANCH },
+    [0xcb] = { "JMP ",      4, 3, 10, 10, JUMP },
+    [0xcc] = { "CZ ",       3, 3, 11, 17, CALL },
+    [0xcd] = { "CALL ",     5, 3, 17, 17, CALL },
+    [0xce] = { "ACI ",      4, 2,  7,  7, NEXT },
+    [0xcf] = { "RST 1",     5, 1, 11, 11, RST },
+    [0xd0] = { "RNC",       3, 1,  5, 11, COND_RETURN },
+    [0xd1] = { "POP D",     5, 1, 10, 10, NEXT },
+    [0xd2] = { "JNC ",      4, 3, 10, 10, BRANCH },
+    [0xd3] = { "OUT ",      4, 2, 10, 10, NEXT },
+    [0xd4] = { "CNC ",      4, 3, 11, 17, CALL },
+    [0xd5] = { "PUSH D",    6, 1, 11, 11, NEXT },
+    [0xd6] = { "SUI ",      4, 2,  7,  7, NEXT },
+    [0xd7] = { "RST 2",     5, 1, 11, 11, RST },
+    [0xd8] = { "RC",        2, 1,  5, 11, COND_RETURN },
+    [0xd9] = { "RET",       3, 1, 10, 10, RETURN },
+    [0xda] = { "JC ",       3, 3, 10, 10, BRANCH },
+    [0xdb] = { "IN ",       3, 2, 10, 10, NEXT },
+    [0xdc] = { "CC ",       3, 3, 11, 17, CALL },
+    [0xdd] = { "CALL ",     5, 3, 17, 17, CALL },
+    [0xde] = { "SBI ",      4, 2,  7,  7, NEXT },
+    [0xdf] = { "RST 3",     5, 1, 11, 11, RST },
+    [0xe0] = { "RPO",       3, 1,  5, 11, COND_RETURN },
+    [0xe1] = { "POP H",     5, 1, 10, 10, NEXT },
+    [0xe2] = { "JPO ",      4, 3, 10, 10, BRANCH },
+    [0xe3] = { "XTHL",      4, 1, 18, 18, NEXT },
+    [0xe4] = { "CPO ",      4, 3, 11, 17, CALL },
+    [0xe5] = { "PUSH H",    6, 1, 11, 11, NEXT },
+    [0xe6] = { "ANI ",      4, 2,  7,  7, NEXT },
+    [0xe7] = { "RST 4",     5, 1, 11, 11, RST },
+    [0xe8] = { "RPE",       3, 1,  5, 11, COND_RETURN },
+    [0xe9] = { "PCHL",      4, 1,  5,  5, PCHL },
+    [0xea] = { "JPE ",      4, 3, 10, 10, BRANCH },
+    [0xeb] = { "XCHG",      4, 1,  4,  4, NEXT },
+    [0xec] = { "CPE ",      4, 3, 11, 17, CALL },
+    [0xed] = { "CALL ",     5, 3, 17, 17, CALL },
+    [0xee] = { "XRI ",      4, 2,  7,  7, NEXT },
+    [0xef] = { "RST 5",     5, 1, 11, 11, RST },
+    [0xf0] = { "RP",        2, 1,  5, 11, COND_RETURN },
+    [0xf1] = { "POP PSW",   7, 1, 10, 10, NEXT },
+    [0xf2] = { "JP ",       3, 3, 10, 10, BRANCH },
+    [0xf3] = { "DI",        2, 1,  4,  4, NEXT },
+    [0xf4] = { "CP ",       3, 3, 11, 17, CALL },
+    [0xf5] = { "PUSH PSW",  8, 1, 11, 11, NEXT },
+    [0xf6] = { "ORI ",      4, 2,  7,  7, NEXT },
+    [0xf7] = { "RST 6",     5, 1, 11, 11, RST },
+    [0xf8] = { "RM",        2, 1,  5, 11, COND_RETURN },
+    [0xf9] = { "SPHL",      4, 1,  5,  5, NEXT },
+    [0xfa] = { "JM ",       3, 3, 10, 10, BRANCH },
+    [0xfb] = { "EI",        2, 1,  4,  4, NEXT },
+    [0xfc] = { "CM ",       3, 3, 11, 17, CALL },
+    [0xfd] = { "CALL ",     5, 3, 17, 17, CALL },
+    [0xfe] = { "CPI ",      4, 2,  7,  7, NEXT },
+    [0xff] = { "RST 7",     5, 1, 11, 11, RST },
+};
+
+
+static const char hex[] = "0123456789abcdef";
+
+
+// Write the instruction at code into buf (at least DISASM_SIZE bytes). code
+// must have three bytes readable, whatever the length of the instruction.
+// Returns its length in bytes, and its cycles in *cycles unless it is NULL.
+int disasm(const uint8_t *code, char *buf, size_t size, int *cycles) {
+    assert(size >= DISASM_SIZE);
+
+    const disasm_op_t *op = &disasm_ops[code[0]];
+
+    // Copy the whole text field, then the operand high byte first. Digits
+    // past the operand of shorter instructions are cut off by the NUL.
+    memcpy(buf, op->text, sizeof op->text);
+    char *s = buf + op->text_length;
+    uint8_t high = code[op->length == 3 ? 2 : 1];
+    s[0] = hex[high >> 4];
+    s[1] = hex[high & 0xf];
+    s[2] = hex[code[1] >> 4];
+    s[3] = hex[code[1] & 0xf];
+    s[(op->length - 1) * 2] = '\0';
+
+    if (cycles) {
+        *cycles = op->cycles;
     }
+    return op->length;
+}
+
+
+void disassemble(const uint8_t *code) {
+    char buf[DISASM_SIZE];
+    disasm(code, buf, sizeof buf, NULL);
+    fputs(buf, stdout);
 }
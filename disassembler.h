@@ -1,8 +1,36 @@
 #ifndef _H_DISASSEMBLER_
 #define _H_DISASSEMBLER_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define DISASM_SIZE 16  // Enough for the longest instruction, "LXI SP, 1234"
+
+// How control leaves an instruction
+enum {
+    DISASM_NEXT,         // On to the next one
+    DISASM_JUMP,         // JMP
+    DISASM_BRANCH,       // Jcc
+    DISASM_CALL,         // CALL, Ccc
+    DISASM_RST,
+    DISASM_RETURN,       // RET
+    DISASM_COND_RETURN,  // Rcc
+    DISASM_PCHL,
+    DISASM_HALT,         // On to the next one after an interrupt
+};
+
+typedef struct {
+    char text[12];         // Mnemonic and operands up to the immediate one
+    uint8_t text_length;
+    uint8_t length;        // Bytes
+    uint8_t cycles;        // Cycles, when the condition fails for conditional ones
+    uint8_t cycles_taken;  // Cycles when the condition holds
+    uint8_t flow;          // DISASM_NEXT...
+} disasm_op_t;
+
+extern const disasm_op_t disasm_ops[256];
+
+int disasm(const uint8_t *code, char *buf, size_t size, int *cycles);
 void disassemble(const uint8_t *code);
 
 #endif
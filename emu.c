@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+
+#include "emu.h"
+#include "disassembler.h"
+
+
+static uint8_t port_in(struct cpu *cpu, uint8_t port) {
+    emu_t *emu = (emu_t *) cpu;
+
+    switch (port) {
+        case 3:  // Shift and read data
+            return emu->shift_register >> (8 - emu->shift_amount);
+        default:
+            return port < sizeof emu->ports ? emu->ports[port] : 0;
+    }
+}
+
+
+static void port_out(struct cpu *cpu, uint8_t port, uint8_t value) {
+    emu_t *emu = (emu_t *) cpu;
+
+    switch (port) {
+        case 2:  // Set shift amount
+            emu->shift_amount = value;
+            break;
+        case 4:  // Set data in shift register
+            emu->shift_register = (value << 8) | (emu->shift_register >> 8);
+            break;
+        default:
+            if (port < sizeof emu->ports) {
+                emu->ports[port] = value;
+            }
+            break;
+    }
+}
+
+
+// Master cycle at which a frame starts, exact over any number of frames
+static uint64_t frame_start(uint64_t frame) {
+    return frame * CYCLES_PER_SECOND / FPS;
+}
+
+// Master cycle at which the beam reaches the middle of the screen
+static uint64_t frame_middle(uint64_t frame) {
+    return (2 * frame + 1) * CYCLES_PER_SECOND / (2 * FPS);
+}
+
+
+emu_t *emu_new() {
+    emu_t *emu = calloc(1, sizeof(emu_t));
+
+    emu->cpu.mem = mem_new(MEM_SIZE);
+    mem_reset(emu->cpu.mem);
+
+    // 8 KB of ROM and 8 KB of RAM, repeated every 16 KB since the board
+    // does not decode A14 and A15
+    for (uint32_t addr = 0; addr < 0x10000; addr += 0x4000) {
+        mem_map(emu->cpu.mem, addr, addr + 0x2000, 0x0000, MEM_ROM);
+        mem_map(emu->cpu.mem, addr + 0x2000, addr + 0x4000, 0x2000, MEM_RAM);
+    }
+
+    emu->cpu.in = port_in;
+    emu->cpu.out = port_out;
+
+    sched_reset(&emu->sched);
+    sched_add(&emu->sched, frame_start(0), EVENT_INPUT);
+    sched_add(&emu->sched, frame_middle(0), EVENT_MIDSCREEN);
+    sched_add(&emu->sched, frame_start(1), EVENT_VBLANK);
+
+    return emu;
+}
+
+
+void emu_free(emu_t *emu) {
+    emu_set_engine(emu, ENGINE_INTERPRETER);
+    mem_free(emu->cpu.mem);
+    free(emu);
+}
+
+
+void emu_load_rom(emu_t *emu, const char *file_name) {
+    // Open file
+    FILE *f = fopen(file_name, "rb");
+    if (!f) {
+        printf("Could not open ROM: %s\n", file_name);
+        exit(1);
+    }
+
+    // Get size
+    fseek(f, 0, SEEK_END);
+    size_t fsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    // Read into buffer
+    unsigned char *buffer = malloc(fsize);
+    fread(buffer, fsize, 1, f);
+
+    // Load into memory
+    mem_load(emu->cpu.mem, 0, buffer, fsize);
+
+    // Clean up
+    free(buffer);
+    fclose(f);
+}
+
+
+// Switch execution engine. Returns 0 if it is not available on this host, in
+// which case the interpreter is used.
+int emu_set_engine(emu_t *emu, engine_t engine) {
+    // Only one engine at a time, they share the memory write watch
+    if (emu->uop) {
+        uop_free(emu->uop);
+        emu->uop = NULL;
+    }
+    if (emu->jit) {
+        jit_free(emu->jit);
+        emu->jit = NULL;
+    }
+
+    switch (engine) {
+        case ENGINE_INTERPRETER:
+            return 1;
+        case ENGINE_UOP:
+            emu->uop = uop_new(&emu->cpu);
+            return 1;
+        case ENGINE_JIT:
+            emu->jit = jit_new(&emu->cpu);
+            return emu->jit != NULL;
+    }
+
+    return 0;
+}
+
+
+// Record every instruction before running it, one at a time through the
+// interpreter whatever the engine
+static long emu_run_traced(emu_t *emu, long cycles) {
+    struct cpu *cpu = &emu->cpu;
+
+    long i = 0;
+    while (i < cycles) {
+        trace_add(emu->trace, emu->sched.now + i, cpu);
+        cpu_fetch(cpu);
+
+        int c = cpu_run_instruction(cpu);
+        if (!c) {
+            return -1;
+        }
+        i += c;
+    }
+
+    return i;
+}
+
+
+// Trace into trace, or stop tracing if it is NULL. The caller closes it.
+void emu_set_trace(emu_t *emu, trace_t *trace) {
+    emu->trace = trace;
+}
+
+
+static long emu_run(emu_t *emu, long cycles) {
+    if (emu->trace) {
+        return emu_run_traced(emu, cycles);
+    }
+    if (emu->jit) {
+        return jit_run(emu->jit, cycles);
+    }
+    if (emu->uop) {
+        return uop_run(emu->uop, cycles);
+    }
+
+    return cpu_run(&emu->cpu, cycles);
+}
+
+
+void emu_interrupt(emu_t *emu, uint16_t addr) {
+    if (emu->cpu.halted) {
+        emu->cpu.pc++;  // Return past the HLT
+        emu->cpu.halted = 0;
+    }
+    cpu_push(&emu->cpu, emu->cpu.pc);
+    emu->cpu.pc = addr;
+    emu->cpu.inte = 0;
+}
+
+
+// Have on_audio() called rate times per second of emulated time, or never if
+// it is NULL or rate is not positive
+void emu_set_audio(emu_t *emu, void (*on_audio)(emu_t *emu), long rate) {
+    sched_remove(&emu->sched, EVENT_AUDIO);
+
+    if (!on_audio || rate <= 0) {
+        emu->on_audio = NULL;
+        emu->audio_rate = 0;
+        emu->audio_samples = 0;
+        return;
+    }
+
+    emu->on_audio = on_audio;
+    emu->audio_rate = rate;
+    emu->audio_samples = emu->sched.now * rate / CYCLES_PER_SECOND + 1;
+    sched_add(&emu->sched, emu->audio_samples * CYCLES_PER_SECOND / rate, EVENT_AUDIO);
+}
+
+
+// Handle a due event and schedule its next occurrence. Returns 1 at the end
+// of a frame.
+static int emu_event(emu_t *emu, const event_t *event) {
+    switch (event->type) {
+        case EVENT_MIDSCREEN:
+            if (emu->cpu.inte) {
+                emu_interrupt(emu, 0x08);
+            }
+            sched_add(&emu->sched, frame_middle(emu->frame + 1), EVENT_MIDSCREEN);
+            return 0;
+
+        case EVENT_VBLANK:
+            if (emu->cpu.inte) {
+                emu_interrupt(emu, 0x10);
+            }
+            emu->frame++;
+            sched_add(&emu->sched, frame_start(emu->frame + 1), EVENT_VBLANK);
+            return 1;
+
+        case EVENT_INPUT:
+            if (emu->on_input) {
+                emu->on_input(emu);
+            }
+            sched_add(&emu->sched, frame_start(emu->frame + 1), EVENT_INPUT);
+            return 0;
+
+        case EVENT_AUDIO:
+            emu->on_audio(emu);
+            emu->audio_samples++;
+            sched_add(&emu->sched, emu->audio_samples * CYCLES_PER_SECOND / emu->audio_rate, EVENT_AUDIO);
+            return 0;
+    }
+
+    return 0;
+}
+
+
+// Handle the events that are due, then run the CPU for up to cycles, but not
+// past the next event. Any cycles its last instruction took beyond that are
+// kept in the master counter, so interrupts never drift. Returns 1 when an
+// event ends the frame (the CPU does not run then), -1 if the CPU hit an
+// unimplemented instruction, 0 otherwise.
+int emu_step(emu_t *emu, long cycles) {
+    event_t event;
+    while (sched_pop(&emu->sched, &event)) {
+        if (emu_event(emu, &event)) {
+            return 1;
+        }
+    }
+
+    long deadline = sched_deadline(&emu->sched) - emu->sched.now;
+    if (cycles > deadline) {
+        cycles = deadline;
+    }
+
+    cycles = emu_run(emu, cycles);
+    if (cycles < 0) {
+        return -1;
+    }
+    emu->sched.now += cycles;
+
+    return 0;
+}
+
+
+// Run until the end of the current video frame. Returns -1 if the CPU hit an
+// unimplemented instruction, 0 otherwise.
+int emu_run_frame(emu_t *emu) {
+    int result;
+    do {
+        result = emu_step(emu, LONG_MAX);
+    } while (!result);
+
+    return result < 0 ? -1 : 0;
+}
+
+
+/*
+ * Snapshots
+ *
+ * A snapshot is this header followed by the RAM (see mem_save()), in a flat
+ * buffer of emu_state_size() bytes owned by the caller. The ROM, the engine
+ * caches and the frontend hooks are not part of it, so it can only be
+ * restored into a machine running the same ROM. Nothing is allocated.
+ */
+
+#define SNAPSHOT_MAGIC 0x38303830  // "0808"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    struct cpu cpu;  // Pointers are saved as NULL and not restored
+    uint8_t ports[9];
+    uint16_t shift_register;
+    int shift_amount;
+    sched_t sched;
+    uint64_t frame;
+} snapshot_t;
+
+
+size_t emu_state_size(const emu_t *emu) {
+    return sizeof(snapshot_t) + mem_state_size(emu->cpu.mem);
+}
+
+
+// Fields are copied one by one into a zeroed header, so padding, host
+// pointers and unused event slots are always zero: the same machine state
+// always gives the same bytes, and rewind deltas carry no noise.
+void emu_save(const emu_t *emu, void *buf) {
+    snapshot_t s;
+    memset(&s, 0, sizeof s);
+    s.magic = SNAPSHOT_MAGIC;
+    s.size = emu_state_size(emu);
+
+    s.cpu.ir = emu->cpu.ir;
+    s.cpu.pc = emu->cpu.pc;
+    s.cpu.sp = emu->cpu.sp;
+    s.cpu.bc = emu->cpu.bc;
+    s.cpu.de = emu->cpu.de;
+    s.cpu.hl = emu->cpu.hl;
+    s.cpu.wz = emu->cpu.wz;
+    s.cpu.af = emu->cpu.af;
+    s.cpu.inte = emu->cpu.inte;
+    s.cpu.halted = emu->cpu.halted;
+    s.cpu.instructions = emu->cpu.instructions;
+
+    memcpy(s.ports, emu->ports, sizeof s.ports);
+    s.shift_register = emu->shift_register;
+    s.shift_amount = emu->shift_amount;
+
+    s.sched.now = emu->sched.now;
+    s.sched.count = emu->sched.count;
+    for (int i = 0; i < emu->sched.count; i++) {
+        s.sched.heap[i].when = emu->sched.heap[i].when;
+        s.sched.heap[i].type = emu->sched.heap[i].type;
+    }
+    s.frame = emu->frame;
+
+    memcpy(buf, &s, sizeof s);
+    mem_save(emu->cpu.mem, (uint8_t *) buf + sizeof s);
+}
+
+
+// Returns -1, leaving the machine alone, if buf is not a snapshot of this
+// kind of machine
+int emu_restore(emu_t *emu, const void *buf) {
+    snapshot_t s;
+    memcpy(&s, buf, sizeof s);
+    if (s.magic != SNAPSHOT_MAGIC || s.size != emu_state_size(emu)) {
+        return -1;
+    }
+
+    // Keep this machine's memory and port handlers
+    s.cpu.mem = emu->cpu.mem;
+    s.cpu.in = emu->cpu.in;
+    s.cpu.out = emu->cpu.out;
+    emu->cpu = s.cpu;
+
+    memcpy(emu->ports, s.ports, sizeof emu->ports);
+    emu->shift_register = s.shift_register;
+    emu->shift_amount = s.shift_amount;
+    emu->sched = s.sched;
+    emu->frame = s.frame;
+
+    // Audio sampling belongs to the frontend, not to the snapshot
+    emu_set_audio(emu, emu->on_audio, emu->audio_rate);
+
+    mem_restore(emu->cpu.mem, (const uint8_t *) buf + sizeof s);
+
+    return 0;
+}
+
+
+// Print the last fetched instruction and the registers
+void emu_dump(emu_t *emu) {
+    uint16_t addr = emu->cpu.pc - cpu_length(emu->cpu.ir);
+    uint8_t code[3];
+    for (int i = 0; i < 3; i++) {
+        code[i] = mem_read(emu->cpu.mem, addr + i);
+    }
+    disassemble(code);
+    puts("");
+    cpu_dump(&emu->cpu);
+}
@@ -0,0 +1,77 @@
+#ifndef _H_EMU_
+#define _H_EMU_
+
+#include <stdint.h>
+
+#include "mem.h"
+#include "cpu.h"
+#include "uop.h"
+#include "jit.h"
+#include "sched.h"
+#include "trace.h"
+
+#define MEM_SIZE 0x10000
+#define HEIGHT 256
+#define WIDTH 224
+#define VRAM_START 0x2400
+#define VRAM_END 0x4000
+#define FPS 60
+#define CYCLES_PER_SECOND 2000000  // 8080 runs at 2 Mhz
+
+// How the CPU is run
+typedef enum {
+    ENGINE_INTERPRETER,  // cpu_run()
+    ENGINE_UOP,          // Predecoded instruction cache, see uop.c
+    ENGINE_JIT,          // x86-64 recompiler for the ROM, see jit.c
+} engine_t;
+
+// Scheduled events, in the order they run when due at the same cycle
+enum {
+    EVENT_VBLANK,     // RST 2, ends the frame
+    EVENT_MIDSCREEN,  // RST 1, halfway down the screen
+    EVENT_INPUT,      // Frontend samples its inputs, at the start of a frame
+    EVENT_AUDIO,      // Frontend samples the sound ports
+};
+
+// A whole Space Invaders machine. Nothing is shared between instances, so
+// any number of them can run side by side, one per thread.
+typedef struct emu {
+    struct cpu cpu;  // Must be first, port handlers get a pointer to it
+
+    uint8_t ports[9];
+
+    // Shift register (external hardware, see Computer Archeology)
+    uint16_t shift_register;
+    int shift_amount;
+
+    // Execution engine, both NULL for the plain interpreter
+    uop_cache_t *uop;
+    jit_t *jit;
+
+    trace_t *trace;  // Every instruction goes to it when set
+
+    sched_t sched;   // sched.now is the master cycle counter
+    uint64_t frame;  // Frames completed
+
+    // Optional frontend hooks
+    void (*on_input)(struct emu *emu);
+    void (*on_audio)(struct emu *emu);
+    long audio_rate;  // Samples per second
+    uint64_t audio_samples;
+} emu_t;
+
+emu_t *emu_new();
+void emu_free(emu_t *emu);
+void emu_load_rom(emu_t *emu, const char *file_name);
+int emu_set_engine(emu_t *emu, engine_t engine);
+void emu_set_trace(emu_t *emu, trace_t *trace);
+void emu_interrupt(emu_t *emu, uint16_t addr);
+void emu_set_audio(emu_t *emu, void (*on_audio)(emu_t *emu), long rate);
+int emu_step(emu_t *emu, long cycles);
+int emu_run_frame(emu_t *emu);
+size_t emu_state_size(const emu_t *emu);
+void emu_save(const emu_t *emu, void *buf);
+int emu_restore(emu_t *emu, const void *buf);
+void emu_dump(emu_t *emu);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "flow.h"
+#include "disassembler.h"
+
+/*
+ * Control flow analysis
+ *
+ * Recursive descent from the entry points: code is decoded from every
+ * address known to be reached until an instruction that does not go on to
+ * the next one (JMP, RET, PCHL), queueing the targets of jumps, calls and
+ * RSTs on the way. Calls are assumed to return. Only the ROM is followed, and
+ * PCHL targets, which depend on run-time values, are left for the caller to
+ * add as entry points once known.
+ *
+ * Blocks are then cut at every instruction that transfers control and at
+ * every address something jumps to, and each one is given to the first
+ * function, in address order, whose jumps reach it. Jumps to the entry of
+ * another function are tail calls: that block stays with its own function.
+ */
+
+// Destination of a jump, call or RST at addr
+static uint16_t target(const uint8_t *rom, int addr) {
+    if (disasm_ops[rom[addr]].flow == DISASM_RST) {
+        return rom[addr] & 0x38;
+    }
+    return rom[addr + 2] << 8 | rom[addr + 1];
+}
+
+
+typedef struct {
+    flow_t *flow;
+    const uint8_t *rom;
+    uint16_t *stack;  // Leaders still to be decoded
+    int count;
+} walk_t;
+
+// Queue addr to be decoded, as the start of a block
+static void reach(walk_t *w, uint16_t addr, int function) {
+    flow_t *flow = w->flow;
+
+    if (addr >= flow->size) {
+        flow->external++;
+        return;
+    }
+    if (function) {
+        flow->flags[addr] |= FLOW_FUNCTION;
+    }
+    if (!(flow->flags[addr] & FLOW_LEADER)) {
+        flow->flags[addr] |= FLOW_LEADER;
+        w->stack[w->count++] = addr;
+    }
+}
+
+// Decode from addr until control leaves for good
+static void decode(walk_t *w, int addr) {
+    flow_t *flow = w->flow;
+
+    while (addr < flow->size && !(flow->flags[addr] & FLOW_CODE)) {
+        uint8_t op = w->rom[addr];
+        int length = disasm_ops[op].length;
+
+        if (flow->flags[addr] & FLOW_OPERAND) {
+            flow->overlaps++;
+            return;
+        }
+        if (addr + length > flow->size) {
+            flow->external++;
+            return;
+        }
+
+        flow->flags[addr] |= FLOW_CODE;
+        for (int i = 1; i < length; i++) {
+            if (flow->flags[addr + i] & FLOW_CODE) {
+                flow->overlaps++;
+            }
+            flow->flags[addr + i] |= FLOW_OPERAND;
+        }
+
+        switch (disasm_ops[op].flow) {
+            case DISASM_JUMP:
+                reach(w, target(w->rom, addr), 0);
+                return;
+            case DISASM_BRANCH:
+                reach(w, target(w->rom, addr), 0);
+                reach(w, addr + length, 0);
+                return;
+            case DISASM_CALL:
+            case DISASM_RST:
+                reach(w, target(w->rom, addr), 1);
+                reach(w, addr + length, 0);
+                return;
+            case DISASM_COND_RETURN:
+            case DISASM_HALT:
+                reach(w, addr + length, 0);
+                return;
+            case DISASM_RETURN:
+                return;
+            case DISASM_PCHL:
+                flow->indirect[flow->indirect_count++] = addr;
+                return;
+        }
+
+        addr += length;
+    }
+
+    if (addr >= flow->size) {
+        flow->external++;
+    }
+}
+
+
+// Cut the decoded code into blocks
+static void cut_blocks(flow_t *flow, const uint8_t *rom) {
+    for (int addr = 0; addr < flow->size; addr++) {
+        if (!(flow->flags[addr] & FLOW_LEADER) || !(flow->flags[addr] & FLOW_CODE)) {
+            continue;
+        }
+
+        flow_block_t *b = &flow->blocks[flow->block_count];
+        flow->block_at[addr] = flow->block_count++;
+        b->start = addr;
+        b->flags = 0;
+
+        int pc = addr;
+        for (;;) {
+            int next = pc + disasm_ops[rom[pc]].length;
+            int c = disasm_ops[rom[pc]].flow;
+
+            if (c != DISASM_NEXT || next >= flow->size || !(flow->flags[next] & FLOW_CODE) ||
+                    flow->flags[next] & FLOW_LEADER) {
+                b->last = pc;
+                b->end = next;
+
+                if (c == DISASM_JUMP || c == DISASM_BRANCH || c == DISASM_CALL || c == DISASM_RST) {
+                    b->flags |= FLOW_TARGET;
+                    b->target = target(rom, pc);
+                }
+                if (c == DISASM_CALL || c == DISASM_RST) {
+                    b->flags |= FLOW_CALL;
+                }
+                if (c != DISASM_JUMP && c != DISASM_RETURN && c != DISASM_PCHL && next < flow->size &&
+                        flow->flags[next] & FLOW_CODE) {
+                    b->flags |= FLOW_NEXT;
+                }
+                if (c == DISASM_PCHL) {
+                    b->flags |= FLOW_INDIRECT;
+                }
+                break;
+            }
+
+            pc = next;
+        }
+    }
+}
+
+
+// Give the blocks function reaches, without following calls or entering
+// other functions, that no other function has
+static void claim_blocks(flow_t *flow, uint16_t function, int *stack, uint8_t *claimed) {
+    int count = 0;
+    int first = flow->block_at[function];
+    if (first < 0 || claimed[first]) {
+        return;
+    }
+    claimed[first] = 1;
+    stack[count++] = first;
+
+    while (count) {
+        flow_block_t *b = &flow->blocks[stack[--count]];
+        b->function = function;
+
+        int succ[2] = { -1, -1 };
+        if (b->flags & FLOW_TARGET && !(b->flags & FLOW_CALL) && b->target < flow->size) {
+            succ[0] = flow->block_at[b->target];
+        }
+        if (b->flags & FLOW_NEXT) {
+            succ[1] = flow->block_at[b->end];
+        }
+
+        // Other functions keep their own entries, even when jumped into
+        for (int i = 0; i < 2; i++) {
+            if (succ[i] >= 0 && !claimed[succ[i]] &&
+                    !(flow->flags[flow->blocks[succ[i]].start] & FLOW_FUNCTION)) {
+                claimed[succ[i]] = 1;
+                stack[count++] = succ[i];
+            }
+        }
+    }
+}
+
+
+// Analyze the first size bytes of rom, from the given entry points. Entries
+// are functions, like the reset and interrupt vectors.
+flow_t *flow_analyze(const uint8_t *rom, int size, const uint16_t *entries, int entry_count) {
+    flow_t *flow = calloc(1, sizeof(flow_t));
+    flow->size = size;
+    flow->flags = calloc(size, 1);
+    flow->block_at = malloc(size * sizeof(int));
+    flow->blocks = malloc(size * sizeof(flow_block_t));
+    flow->functions = malloc(size * sizeof(uint16_t));
+    flow->indirect = malloc(size * sizeof(uint16_t));
+
+    for (int addr = 0; addr < size; addr++) {
+        flow->block_at[addr] = -1;
+    }
+
+    walk_t w = { flow, rom, malloc(size * sizeof(uint16_t)), 0 };
+    for (int i = 0; i < entry_count; i++) {
+        reach(&w, entries[i], 1);
+    }
+    while (w.count) {
+        decode(&w, w.stack[--w.count]);
+    }
+    free(w.stack);
+
+    cut_blocks(flow, rom);
+
+    for (int addr = 0; addr < size; addr++) {
+        if (flow->flags[addr] & FLOW_FUNCTION && flow->flags[addr] & FLOW_CODE) {
+            flow->functions[flow->function_count++] = addr;
+        }
+    }
+
+    int *stack = malloc(flow->block_count * sizeof(int));
+    uint8_t *claimed = calloc(flow->block_count, 1);
+    for (int i = 0; i < flow->function_count; i++) {
+        claim_blocks(flow, flow->functions[i], stack, claimed);
+    }
+    free(claimed);
+    free(stack);
+
+    return flow;
+}
+
+
+void flow_free(flow_t *flow) {
+    free(flow->indirect);
+    free(flow->functions);
+    free(flow->blocks);
+    free(flow->block_at);
+    free(flow->flags);
+    free(flow);
+}
+
+
+// The block starting at addr, or NULL if none does
+const flow_block_t *flow_block_at(const flow_t *flow, uint16_t addr) {
+    if (addr >= flow->size || flow->block_at[addr] < 0) {
+        return NULL;
+    }
+    return &flow->blocks[flow->block_at[addr]];
+}
@@ -0,0 +1,51 @@
+#ifndef _H_FLOW_
+#define _H_FLOW_
+
+#include <stdint.h>
+
+// Per address flags
+#define FLOW_CODE     1   // First byte of an instruction reached
+#define FLOW_OPERAND  2   // Later byte of one
+#define FLOW_LEADER   4   // Starts a block
+#define FLOW_FUNCTION 8   // Entry point, or target of a CALL or RST
+
+// Block flags
+#define FLOW_TARGET   1   // Ends in a jump, call or RST to target
+#define FLOW_CALL     2   // The target is called, not jumped to
+#define FLOW_NEXT     4   // Can go on at end
+#define FLOW_INDIRECT 8   // Ends in a PCHL
+
+// Straight-line code from start to end, only entered at start
+typedef struct {
+    uint16_t start;
+    uint16_t end;       // Past the last instruction
+    uint16_t last;      // Last instruction
+    uint16_t target;
+    uint16_t function;  // Entry of the first function that reaches it
+    uint8_t flags;
+} flow_block_t;
+
+// Control flow of code in ROM
+typedef struct {
+    int size;        // Of the ROM analyzed
+    uint8_t *flags;  // FLOW_CODE..., by address
+    int *block_at;   // Index of the block starting at an address, or -1
+
+    flow_block_t *blocks;  // In address order
+    int block_count;
+
+    uint16_t *functions;  // Entries, in address order
+    int function_count;
+
+    uint16_t *indirect;  // PCHLs, whose targets are unknown
+    int indirect_count;
+
+    int external;  // Jumps, calls and code running out of the ROM, not followed
+    int overlaps;  // Instructions sharing bytes, only the first decoded is kept
+} flow_t;
+
+flow_t *flow_analyze(const uint8_t *rom, int size, const uint16_t *entries, int entry_count);
+void flow_free(flow_t *flow);
+const flow_block_t *flow_block_at(const flow_t *flow, uint16_t addr);
+
+#endif
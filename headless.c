@@ -0,0 +1,430 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "emu.h"
+#include "movie.h"
+#include "lockstep.h"
+
+#define CHUNK 60  // Frames run per task before going back to the queue
+#define RANDOM_HOLD 16  // Frames each random input is held for
+
+// Input bits that can be pressed, see handle_input() in invaders.c
+#define PORT1_INPUTS 0x77
+#define PORT2_INPUTS 0x70
+
+
+/*
+ * Inputs
+ */
+
+typedef struct {
+    long frame;
+    uint8_t port1;
+    uint8_t port2;
+} script_entry;
+
+typedef struct {
+    script_entry *entries;
+    int count;
+} script_t;
+
+// Script files have one "<frame> <port 1> <port 2>" line per change, the
+// ports written as hex bitmasks of the pressed inputs
+static script_t *script_load(const char *file_name) {
+    FILE *f = fopen(file_name, "r");
+    if (!f) {
+        printf("Could not open script: %s\n", file_name);
+        exit(1);
+    }
+
+    script_t *script = calloc(1, sizeof(script_t));
+    int capacity = 0;
+
+    long frame;
+    unsigned port1, port2;
+    while (fscanf(f, "%ld %x %x", &frame, &port1, &port2) == 3) {
+        if (script->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            script->entries = realloc(script->entries, capacity * sizeof(script_entry));
+        }
+        script->entries[script->count++] = (script_entry) { frame, port1, port2 };
+    }
+
+    fclose(f);
+    return script;
+}
+
+
+/*
+ * Instances
+ */
+
+typedef struct {
+    emu_t *emu;
+    lockstep_t *lockstep;  // Checked against an interpreter when set
+    emu_t *ref;
+    long frame;
+    int next_entry;  // Next script entry to apply
+    uint32_t seed;   // Random input state
+    int failed;
+} instance_t;
+
+static uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void apply_input(instance_t *in, const movie_t *movie, const script_t *script) {
+    if (movie) {
+        movie_input(movie, in->frame, &in->emu->ports[1], &in->emu->ports[2]);
+    } else if (script) {
+        while (in->next_entry < script->count &&
+                script->entries[in->next_entry].frame <= in->frame) {
+            const script_entry *e = &script->entries[in->next_entry++];
+            in->emu->ports[1] = e->port1;
+            in->emu->ports[2] = e->port2;
+        }
+    } else if (in->frame % RANDOM_HOLD == 0) {
+        uint32_t r = xorshift(&in->seed);
+        in->emu->ports[1] = r & PORT1_INPUTS;
+        in->emu->ports[2] = (r >> 8) & PORT2_INPUTS;
+    }
+}
+
+
+/*
+ * Work-stealing pool
+ *
+ * Every worker owns a deque of instance indices. It pops from the back of its
+ * own deque and, when that runs dry, steals from the front of the others. An
+ * instance with frames left is pushed back onto the deque of whichever worker
+ * ran it, so slow instances migrate to idle workers on their own.
+ */
+
+typedef struct {
+    pthread_mutex_t lock;
+    int *items;  // Ring buffer with room for every instance
+    int head;
+    int count;
+} deque_t;
+
+typedef struct {
+    instance_t *instances;
+    int n_instances;
+    long frames;
+    const movie_t *movie;
+    const script_t *script;
+
+    deque_t *deques;
+    int n_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;  // Signalled when queued goes up or remaining down
+    int queued;     // Instances in the deques, a bit high while one is taken
+    int remaining;  // Instances not finished yet
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    int id;
+} worker_t;
+
+static void deque_push_back(deque_t *d, int capacity, int item) {
+    pthread_mutex_lock(&d->lock);
+    d->items[(d->head + d->count) % capacity] = item;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static int deque_pop_back(deque_t *d, int capacity) {
+    int item = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->count) {
+        d->count--;
+        item = d->items[(d->head + d->count) % capacity];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+static int deque_pop_front(deque_t *d, int capacity) {
+    int item = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->count) {
+        item = d->items[d->head];
+        d->head = (d->head + 1) % capacity;
+        d->count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+// Queue an instance on the deque of worker id, waking an idle worker
+static void pool_push(pool_t *pool, int id, int item) {
+    deque_push_back(&pool->deques[id], pool->n_instances, item);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Take an instance from worker id's own deque, or steal one. Sleeps while
+// every deque is empty and instances are still running elsewhere. Returns
+// -1 once all are finished.
+static int pool_next(pool_t *pool, int id) {
+    int capacity = pool->n_instances;
+
+    for (;;) {
+        int item = deque_pop_back(&pool->deques[id], capacity);
+        for (int i = 1; item < 0 && i < pool->n_workers; i++) {
+            item = deque_pop_front(&pool->deques[(id + i) % pool->n_workers], capacity);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (item >= 0) {
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+            return item;
+        }
+        while (pool->remaining && !pool->queued) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        int done = !pool->remaining;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (done) {
+            return -1;
+        }
+    }
+}
+
+static void pool_finish(pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (!--pool->remaining) {
+        pthread_cond_broadcast(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void run_chunk(pool_t *pool, instance_t *in) {
+    long end = in->frame + CHUNK;
+    if (end > pool->frames) {
+        end = pool->frames;
+    }
+
+    while (in->frame < end) {
+        apply_input(in, pool->movie, pool->script);
+
+        int result = in->lockstep ? lockstep_run_frame(in->lockstep) : emu_run_frame(in->emu);
+        if (result < 0) {
+            in->failed = 1;
+            return;
+        }
+
+        in->frame++;
+    }
+}
+
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    pool_t *pool = w->pool;
+
+    int item;
+    while ((item = pool_next(pool, w->id)) >= 0) {
+        instance_t *in = &pool->instances[item];
+        run_chunk(pool, in);
+
+        if (in->failed || in->frame >= pool->frames) {
+            pool_finish(pool);
+        } else {
+            pool_push(pool, w->id, item);
+        }
+    }
+
+    return NULL;
+}
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void usage(const char *name) {
+    printf("Usage: %s [-n instances] [-f frames] [-j threads] [-s script] [-m movie] [-e engine] [-l] [-t trace] [rom]\n", name);
+    puts("");
+    puts("Runs instances of the emulator without video and reports the");
+    puts("aggregate frame rate. Inputs are random unless a script or a movie");
+    puts("recorded with invaders -r is given.");
+    puts("Engines: interp (default), uop (predecoded cache), jit (x86-64 only).");
+    puts("-l runs every instance in lockstep with a copy on the interpreter and");
+    puts("stops it at the first difference, with a dump of both.");
+    puts("-t writes a binary trace of every instruction of the first instance,");
+    puts("see tracedump.");
+    exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+    int n_instances = 64;
+    long frames = 3600;  // One minute of game time
+    int n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *script_name = NULL;
+    const char *movie_name = NULL;
+    const char *trace_name = NULL;
+    int lockstep = 0;
+    const char *rom = "invaders.rom";
+    engine_t engine = ENGINE_INTERPRETER;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:j:s:m:e:t:lh")) != -1) {
+        switch (opt) {
+            case 'n': n_instances = atoi(optarg); break;
+            case 'f': frames = atol(optarg); break;
+            case 'j': n_workers = atoi(optarg); break;
+            case 's': script_name = optarg; break;
+            case 'm': movie_name = optarg; break;
+            case 't': trace_name = optarg; break;
+            case 'l': lockstep = 1; break;
+            case 'e':
+                if (!strcmp(optarg, "interp")) {
+                    engine = ENGINE_INTERPRETER;
+                } else if (!strcmp(optarg, "uop")) {
+                    engine = ENGINE_UOP;
+                } else if (!strcmp(optarg, "jit")) {
+                    engine = ENGINE_JIT;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        rom = argv[optind];
+    }
+    if (n_instances < 1 || frames < 1 || n_workers < 1) {
+        usage(argv[0]);
+    }
+
+    movie_t *movie = NULL;
+    if (movie_name) {
+        movie = movie_load(movie_name);
+        if (!movie) {
+            printf("Could not load movie: %s\n", movie_name);
+            return 1;
+        }
+    }
+
+    pool_t pool = {
+        .n_instances = n_instances,
+        .frames = frames,
+        .movie = movie,
+        .script = script_name ? script_load(script_name) : NULL,
+        .n_workers = n_workers,
+        .remaining = n_instances,
+    };
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+
+    // Create instances and deal them out round robin
+    pool.instances = calloc(n_instances, sizeof(instance_t));
+    pool.deques = calloc(n_workers, sizeof(deque_t));
+    for (int i = 0; i < n_workers; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].items = malloc(n_instances * sizeof(int));
+    }
+    for (int i = 0; i < n_instances; i++) {
+        pool.instances[i].emu = emu_new();
+        pool.instances[i].seed = 2463534242u + i;
+        emu_load_rom(pool.instances[i].emu, rom);
+        if (!emu_set_engine(pool.instances[i].emu, engine)) {
+            puts("That engine is not available on this host");
+            return 1;
+        }
+        if (lockstep) {
+            pool.instances[i].ref = emu_new();
+            emu_load_rom(pool.instances[i].ref, rom);
+            pool.instances[i].lockstep = lockstep_new(pool.instances[i].ref, pool.instances[i].emu);
+            if (!pool.instances[i].lockstep) {
+                puts("Could not copy the machine onto the interpreter for lockstep");
+                return 1;
+            }
+        }
+        pool_push(&pool, i % n_workers, i);
+    }
+
+    trace_t *trace = NULL;
+    if (trace_name) {
+        trace = trace_open(trace_name);
+        if (!trace) {
+            printf("Could not create trace: %s\n", trace_name);
+            return 1;
+        }
+        emu_set_trace(pool.instances[0].emu, trace);
+    }
+
+    double start = now();
+
+    pthread_t *threads = malloc(n_workers * sizeof(pthread_t));
+    worker_t *workers = malloc(n_workers * sizeof(worker_t));
+    for (int i = 0; i < n_workers; i++) {
+        workers[i] = (worker_t) { &pool, i };
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    for (int i = 0; i < n_workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    double elapsed = now() - start;
+
+    if (trace) {
+        trace_close(trace);
+    }
+
+    // Report
+    long total_frames = 0;
+    uint64_t instructions = 0;
+    int failed = 0;
+    for (int i = 0; i < n_instances; i++) {
+        instance_t *in = &pool.instances[i];
+        total_frames += in->frame;
+        instructions += in->emu->cpu.instructions;
+        if (in->failed && in->lockstep) {
+            printf("Instance %d: ", i);
+            lockstep_dump(in->lockstep);
+            failed++;
+        } else if (in->failed) {
+            printf("Instance %d: unimplemented instruction at frame %ld: ", i, in->frame);
+            emu_dump(in->emu);
+            failed++;
+        }
+        if (in->lockstep) {
+            lockstep_free(in->lockstep);
+            emu_free(in->ref);
+        }
+        emu_free(in->emu);
+    }
+
+    printf("instances:     %d\n", n_instances);
+    printf("threads:       %d\n", n_workers);
+    printf("frames:        %ld\n", total_frames);
+    printf("seconds:       %.3f\n", elapsed);
+    printf("frames/sec:    %.1f\n", total_frames / elapsed);
+    printf("x real time:   %.1f\n", total_frames / elapsed / 60.0);
+    printf("MIPS:          %.1f\n", instructions / elapsed / 1e6);
+
+    return failed ? 1 : 0;
+}
@@ -1,98 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <SDL.h>
 
-#include "mem.h"
-#include "cpu.h"
-#include "disassembler.h"
+#include "emu.h"
+#include "video.h"
+#include "rewind.h"
+#include "movie.h"
+#include "pace.h"
 
 #define TITLE "Space Invaders"
-#define MEM_SIZE 0x10000
-#define HEIGHT 256
-#define WIDTH 224
-#define TIC (1000.0 / 60.0)  // Milliseconds per tic
-#define CYCLES_PER_MS 2000  // 8080 runs at 2 Mhz
-#define CYCLES_PER_TIC (CYCLES_PER_MS * TIC)
+#define REWIND_BYTES (48 << 20)  // How long this lasts is printed at exit
+#define REWIND_KEYFRAMES 60  // Frames between full snapshots
+
+#define VRAM_SIZE (VRAM_END - VRAM_START)
+#define BANDS (HEIGHT / 8)  // Bands of rows, one byte of each video RAM column
+
+/*
+ * The emulator runs on its own thread, and the main thread handles SDL:
+ * events and presentation. They only share the inputs, a few flags and the
+ * finished frames, all through atomics.
+ */
 
 // Globals
-mem_t *ram;
+emu_t *emu;
+
+rewind_t *rw;
+uint8_t *state;  // emu_state_size() bytes
+int rewinding;   // Backspace held
+
+uint8_t held[3];  // Input bits held down, by port
+int quit;         // Set to stop the emulator thread
+
+int fast_forward;  // Tab held
+long speed = 4;    // Fast forward speed, times real time, 0 for uncapped
+
+movie_t *movie;  // Being recorded, or played back if playing
+const char *movie_name;
+int playing;
 
-SDL_Surface *surf;
 int resizef;
 SDL_Window *win;
-SDL_Surface *winsurf;
+SDL_Renderer *ren;
+SDL_Texture *tex;  // Streaming, WIDTH x HEIGHT times scale
+int scale;         // Integer scale that fits the window, 0 before the first frame
+int refresh_rate;  // Of the display, frames are never presented faster
+uint8_t shown[VRAM_SIZE];  // Video RAM of the frame in tex
+
+int color;      // Colour bands of the cabinet overlay
+int scanlines;  // Darken the last row of every scaled line
+uint32_t pix[WIDTH * HEIGHT];  // Expanded frame, before upscaling
+uint32_t masks[HEIGHT * VIDEO_MAX_SCALE];  // Colour of every texture row
+
+
+/*
+ * Frames
+ *
+ * The emulator thread publishes the video RAM of every finished frame
+ * through a triple buffer. It fills its back buffer and swaps it with the
+ * middle one, and the main thread swaps the middle one with its front buffer
+ * whenever the middle holds a newer frame. The middle index and a fresh bit
+ * are exchanged atomically, so neither thread ever waits for the other, and
+ * frames the main thread had no time for are simply overwritten. A frame
+ * published while none is waiting pushes frame_event, which wakes the main
+ * thread from SDL_WaitEvent().
+ */
+
+#define FRESH 4  // Added to middle while it holds a frame not taken yet
+
+typedef struct {
+    uint8_t vram[VRAM_SIZE];
+} frame_t;
+
+frame_t frames[3];
+int back = 0;    // Emulator thread only
+int middle = 1;
+int front = 2;   // Main thread only
+
+Uint32 frame_event;  // SDL event type registered for waking the main thread
+
+// Emulator thread: wake the main thread
+void wake_main() {
+    SDL_Event ev = { .type = frame_event };
+    SDL_PushEvent(&ev);
+}
+
+// Emulator thread: hand the back buffer over as the newest frame
+void publish_frame() {
+    int old = __atomic_exchange_n(&middle, back | FRESH, __ATOMIC_ACQ_REL);
+    back = old & 3;
+
+    // If the frame replaced was not taken yet, the main thread knows already
+    if (!(old & FRESH)) {
+        wake_main();
+    }
+}
+
+// Main thread: whether a frame not taken yet is waiting
+int frame_waiting() {
+    return __atomic_load_n(&middle, __ATOMIC_ACQUIRE) & FRESH;
+}
+
+// Main thread: take the newest frame into front. Returns 0 if there is none.
+int acquire_frame() {
+    if (!frame_waiting()) {
+        return 0;
+    }
+
+    front = __atomic_exchange_n(&middle, front, __ATOMIC_ACQ_REL) & 3;
+    return 1;
+}
 
 void die() {
     printf("Error: Unimplemented instruction: ");
-    disassemble(&ram->mem[cpu.pc-1]);
-    puts("");
-    cpu_dump(cpu);
+    emu_dump(emu);
     exit(1);
 }
 
 
-void load_rom(mem_t *mem, const char *file_name) {
-    // Open file
-    FILE *f = fopen(file_name, "rb");
-    if (!f) {
-        printf("Could not open ROM: %s\n", file_name);
-        exit(1);
+// Size the texture to the largest integer scale that fits the window
+void resize_texture() {
+    int w, h;
+    if (SDL_GetRendererOutputSize(ren, &w, &h)) {
+        w = WIDTH;
+        h = HEIGHT;
     }
 
-    // Get size
-    fseek(f, 0, SEEK_END);
-    size_t fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    // Read into buffer
-    unsigned char *buffer = malloc(fsize);
-    fread(buffer, fsize, 1, f);
+    int s = w / WIDTH < h / HEIGHT ? w / WIDTH : h / HEIGHT;
+    s = s < 1 ? 1 : s > VIDEO_MAX_SCALE ? VIDEO_MAX_SCALE : s;
+    if (s == scale) {
+        return;
+    }
 
-    // Load into memory
-    mem_load(mem, 0, buffer, fsize);
+    if (tex) {
+        SDL_DestroyTexture(tex);
+    }
+    tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGB888,
+            SDL_TEXTUREACCESS_STREAMING, WIDTH * s, HEIGHT * s);
+    if (!tex) {
+        printf("%s\n", SDL_GetError());
+        exit(1);
+    }
 
-    // Clean up
-    free(buffer);
-    fclose(f);
+    scale = s;
+    video_row_masks(masks, scale, color, scanlines);
 }
 
+// Mark the bands of rows, top to bottom, where vram differs from the frame
+// in the texture. Returns whether any does.
+int changed_bands(const uint8_t *vram, uint8_t *changed) {
+    memset(changed, 0, BANDS);
 
-void draw_video_ram() {
-    uint32_t *pix = surf->pixels;
+    int any = 0;
+    for (int i = 0; i < VRAM_SIZE; i++) {
+        if (vram[i] != shown[i]) {
+            changed[BANDS - 1 - i % BANDS] = 1;
+            any = 1;
+        }
+    }
 
-    int i = 0x2400;  // Start of Video RAM
-    for (int col = 0; col < WIDTH; col ++) {
-        for (int row = HEIGHT; row > 0; row -= 8) {
-            for (int j = 0; j < 8; j++) {
-                int idx = (row - j) * WIDTH + col;
+    return any;
+}
 
-                if (ram->mem[i] & 1 << j) {
-                    pix[idx] = 0xFFFFFF;
-                } else {
-                    pix[idx] = 0x000000;
-                }
-            }
+// Expand, upscale and colour rows [top, bottom) of the frame straight into
+// the same rows of the texture. Locking hands back undefined pixels, so the
+// whole locked rect is written.
+void draw_rows(const uint8_t *vram, int top, int bottom) {
+    video_expand_rows(vram, pix, WIDTH, top, bottom);
 
-            i++;
-        }
+    SDL_Rect rect = { 0, top * scale, WIDTH * scale, (bottom - top) * scale };
+    void *out;
+    int pitch;
+    if (SDL_LockTexture(tex, &rect, &out, &pitch)) {
+        puts(SDL_GetError());
+        return;
     }
+    video_upscale(&pix[top * WIDTH], out, pitch / sizeof(uint32_t), scale,
+            &masks[top * scale], bottom - top);
+    SDL_UnlockTexture(tex);
+}
+
+// Redraw the rows of a new frame that changed, each run of changed bands
+// through its own texture rect, and present it. A new texture gets all rows.
+void draw_video_ram(const uint8_t *vram) {
+    uint8_t changed[BANDS];
 
     if (resizef) {
-        winsurf = SDL_GetWindowSurface(win);
+        resize_texture();
+        resizef = 0;
+        memset(changed, 1, BANDS);
+    } else if (!changed_bands(vram, changed)) {
+        return;
     }
+    memcpy(shown, vram, VRAM_SIZE);
 
-    SDL_BlitScaled(surf, NULL, winsurf, NULL);
+    for (int band = 0; band < BANDS; band++) {
+        if (!changed[band]) {
+            continue;
+        }
 
-    // Update window
-    if (SDL_UpdateWindowSurface(win)) {
-        puts(SDL_GetError());
+        int first = band;
+        while (band < BANDS && changed[band]) {
+            band++;
+        }
+        draw_rows(vram, first * 8, band * 8);
     }
+
+    SDL_RenderClear(ren);
+    SDL_RenderCopy(ren, tex, NULL, NULL);
+    SDL_RenderPresent(ren);
 }
 
 int HandleResize(void *userdata, SDL_Event *ev) {
     if (ev->type == SDL_WINDOWEVENT) {
-        if (ev->window.event == SDL_WINDOWEVENT_RESIZED) {
+        if (ev->window.event == SDL_WINDOWEVENT_RESIZED ||
+                ev->window.event == SDL_WINDOWEVENT_EXPOSED) {
             resizef = 1;
         }
     }
@@ -102,16 +229,214 @@ int HandleResize(void *userdata, SDL_Event *ev) {
 
 
 
+// Main thread: press and release inputs for the emulator thread
+void hold(int port, uint8_t bit) {
+    __atomic_or_fetch(&held[port], bit, __ATOMIC_RELAXED);
+}
+
+void release(int port, uint8_t bit) {
+    __atomic_and_fetch(&held[port], ~bit, __ATOMIC_RELAXED);
+}
+
+// Main thread: handle one SDL event
+void handle_event(const SDL_Event *ev) {
+    switch (ev->type) {
+        case SDL_KEYDOWN:
+            switch (ev->key.keysym.sym) {
+                case 'c':  // Insert coin
+                    hold(1, 1);
+                    break;
+                case 's':  // P1 Start
+                    hold(1, 1 << 2);
+                    break;
+                case 'w': // P1 Shoot
+                    hold(1, 1 << 4);
+                    break;
+                case 'a': // P1 Move Left
+                    hold(1, 1 << 5);
+                    break;
+                case 'd': // P1 Move Right
+                    hold(1, 1 << 6);
+                    break;
+                case SDLK_LEFT: // P2 Move Left
+                    hold(2, 1 << 5);
+                    break;
+                case SDLK_RIGHT: // P2 Move Right
+                    hold(2, 1 << 6);
+                    break;
+                case SDLK_RETURN: // P2 Start
+                    hold(1, 1 << 1);
+                    break;
+                case SDLK_UP: // P2 Shoot
+                    hold(2, 1 << 4);
+                    break;
+                case SDLK_BACKSPACE: // Rewind
+                    __atomic_store_n(&rewinding, 1, __ATOMIC_RELAXED);
+                    break;
+                case SDLK_TAB: // Fast forward
+                    __atomic_store_n(&fast_forward, 1, __ATOMIC_RELAXED);
+                    break;
+            }
+            break;
+
+        case SDL_KEYUP:
+            switch (ev->key.keysym.sym) {
+                case 'c': // Insert coin
+                    release(1, 1);
+                    break;
+                case 's': // P1 Start
+                    release(1, 1 << 2);
+                    break;
+                case 'w': // P1 shoot
+                    release(1, 1 << 4);
+                    break;
+                case 'a': // P1 Move left
+                    release(1, 1 << 5);
+                    break;
+                case 'd': // P1 Move Right
+                    release(1, 1 << 6);
+                    break;
+                case SDLK_LEFT: // P2 Move Left
+                    release(2, 1 << 5);
+                    break;
+                case SDLK_RIGHT: // P2 Move Right
+                    release(2, 1 << 6);
+                    break;
+                case SDLK_RETURN: // P2 Start
+                    release(1, 1 << 1);
+                    break;
+                case SDLK_UP: // P2 Shoot
+                    release(2, 1 << 4);
+                    break;
+                case SDLK_BACKSPACE: // Rewind
+                    __atomic_store_n(&rewinding, 0, __ATOMIC_RELAXED);
+                    break;
+                case SDLK_TAB: // Fast forward
+                    __atomic_store_n(&fast_forward, 0, __ATOMIC_RELAXED);
+                    break;
+
+                case 'q':  // Quit
+                    __atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+                    break;
+            }
+            break;
+
+        case SDL_QUIT:
+            __atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+            break;
+    }
+}
+
+
+// Called by the emulator at the start of every frame
+void handle_input(emu_t *emu) {
+    emu->ports[1] = __atomic_load_n(&held[1], __ATOMIC_RELAXED);
+    emu->ports[2] = __atomic_load_n(&held[2], __ATOMIC_RELAXED);
+
+    if (playing) {
+        movie_input(movie, emu->frame, &emu->ports[1], &emu->ports[2]);
+    } else if (movie) {
+        movie_record(movie, emu->frame, emu->ports[1], emu->ports[2]);
+    }
+}
+
+
+void save_movie() {
+    if (movie_save(movie, movie_name)) {
+        printf("Could not write movie: %s\n", movie_name);
+    }
+}
+
+
+// Go back one frame, keeping the inputs held right now
+void step_back() {
+    // The newest snapshot is the frame on screen, skip it
+    uint64_t frame = emu->frame;
+    while (rewind_pop(rw, state)) {
+        emu_restore(emu, state);
+        if (emu->frame < frame) {
+            break;
+        }
+    }
+
+    emu->ports[1] = __atomic_load_n(&held[1], __ATOMIC_RELAXED);
+    emu->ports[2] = __atomic_load_n(&held[2], __ATOMIC_RELAXED);
+}
+
+
+// Emulator thread: run a frame every tic and publish it
+void *run_emulator(void *arg) {
+    pace_t pace;
+    pace_init(&pace, FPS);
+    int fast = 0;
+
+    uint32_t start = SDL_GetTicks();
+    while (!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+        if (playing && emu->frame >= movie->count) {
+            double seconds = (SDL_GetTicks() - start) / 1000.0;
+            printf("%ld frames in %.3f s, %.1f frames/sec\n",
+                    movie->count, seconds, movie->count / seconds);
+            __atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+            wake_main();
+            break;
+        }
+
+        if (__atomic_load_n(&rewinding, __ATOMIC_RELAXED) && !playing) {
+            step_back();
+        } else {
+            if (emu_run_frame(emu) < 0) {
+                die();
+            }
+
+            emu_save(emu, state);
+            rewind_push(rw, state);
+        }
+
+        memcpy(frames[back].vram, &emu->cpu.mem->mem[VRAM_START], VRAM_SIZE);
+        publish_frame();
+
+        if (fast != __atomic_load_n(&fast_forward, __ATOMIC_RELAXED)) {
+            fast = !fast;
+            pace_set_rate(&pace, fast ? FPS * speed : FPS);
+        }
+
+        // Movies play back unpaced, anything else sleeps until the next tic
+        if (playing || (fast && !speed)) {
+            continue;
+        }
+        if (pace_wait(&pace) && !fast) {
+            puts("Too slow!");
+        }
+    }
+
+    pace_report(&pace, stdout);
+    rewind_report(rw, FPS, stdout);
+    return NULL;
+}
+
+
 void init() {
+    // Pick the video conversion code for this CPU, before any thread runs
+    video_init();
+
     // Init 8080
-    ram = mem_new(MEM_SIZE);
-    cpu.mem = ram;
+    emu = emu_new();
+    emu->on_input = handle_input;
+
+    // Init rewind history
+    state = malloc(emu_state_size(emu));
+    rw = rewind_new(emu_state_size(emu), REWIND_BYTES, REWIND_KEYFRAMES);
 
     // Init SDL
     if (SDL_Init(SDL_INIT_VIDEO)) {
         printf("%s\n", SDL_GetError());
         exit(1);
     }
+    frame_event = SDL_RegisterEvents(1);
+    if (frame_event == (Uint32) -1) {
+        printf("%s\n", SDL_GetError());
+        exit(1);
+    }
 
     // Create a window
     win = SDL_CreateWindow(
@@ -125,171 +450,114 @@ void init() {
         exit(1);
     }
 
-    // Get surface
-    winsurf = SDL_GetWindowSurface(win);
-    if (!winsurf) {
-        puts("Failed to get surface");
+    // Create a renderer, falling back to software where there is no GPU
+    ren = SDL_CreateRenderer(win, -1, 0);
+    if (!ren) {
+        ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_SOFTWARE);
+    }
+    if (!ren) {
+        printf("%s\n", SDL_GetError());
         exit(1);
     }
 
+    // Present at most once per refresh of the display
+    SDL_DisplayMode mode;
+    refresh_rate = FPS;
+    if (!SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(win), &mode) &&
+            mode.refresh_rate > 0) {
+        refresh_rate = mode.refresh_rate;
+    }
+
     // Handle resize events
     SDL_AddEventWatch(HandleResize, NULL);
+    resizef = 1;  // Create the texture and present the first frame
+}
 
-    // Create backbuffer surface
-    surf = SDL_CreateRGBSurface(0, WIDTH, HEIGHT, 32, 0, 0, 0, 0);
+void usage(const char *name) {
+    printf("Usage: %s [-r movie | -p movie] [-f speed] [-c] [-s]\n", name);
+    puts("");
+    puts("-r records the inputs of this run into a movie, -p plays one back");
+    puts("as fast as possible and reports the frame rate.");
+    puts("-f sets how many times real time holding Tab runs the game at,");
+    puts("0 for as fast as possible. The default is 4.");
+    puts("-c colours the screen like the cellophane overlay of the cabinet,");
+    puts("-s adds scanlines.");
+    exit(1);
 }
 
-void handle_input() {
-    SDL_Event ev;
-    while (SDL_PollEvent(&ev)) {
-        switch (ev.type) {
-            case SDL_KEYDOWN:
-                switch (ev.key.keysym.sym) {
-                    case 'c':  // Insert coin
-                        cpu.ports[1] |= 1;
-                        break;
-                    case 's':  // P1 Start
-                        cpu.ports[1] |= 1 << 2;
-                        break;
-                    case 'w': // P1 Shoot
-                        cpu.ports[1] |= 1 << 4;
-                        break;
-                    case 'a': // P1 Move Left
-                        cpu.ports[1] |= 1 << 5;
-                        break;
-                    case 'd': // P1 Move Right
-                        cpu.ports[1] |= 1 << 6;
-                        break;
-                    case SDLK_LEFT: // P2 Move Left
-                        cpu.ports[2] |= 1 << 5;
-                        break;
-                    case SDLK_RIGHT: // P2 Move Right
-                        cpu.ports[2] |= 1 << 6;
-                        break;
-                    case SDLK_RETURN: // P2 Start
-                        cpu.ports[1] |= 1 << 1;
-                        break;
-                    case SDLK_UP: // P2 Shoot
-                        cpu.ports[2] |= 1 << 4;
-                        break;
-                }
-                break;
 
-            case SDL_KEYUP:
-                switch (ev.key.keysym.sym) {
-                    case 'c': // Insert coin
-                        cpu.ports[1] &= ~1;
-                        break;
-                    case 's': // P1 Start
-                        cpu.ports[1] &= ~(1 << 2);
-                        break;
-                    case 'w': // P1 shoot
-                        cpu.ports[1] &= ~(1 << 4);
-                        break;
-                    case 'a': // P1 Move left
-                        cpu.ports[1] &= ~(1 << 5);
-                        break;
-                    case 'd': // P1 Move Right
-                        cpu.ports[1] &= ~(1 << 6);
-                        break;
-                    case SDLK_LEFT: // P2 Move Left
-                        cpu.ports[2] &= ~(1 << 5);
-                        break;
-                    case SDLK_RIGHT: // P2 Move Right
-                        cpu.ports[2] &= ~(1 << 6);
-                        break;
-                    case SDLK_RETURN: // P2 Start
-                        cpu.ports[1] &= ~(1 << 1);
-                        break;
-                    case SDLK_UP: // P2 Shoot
-                        cpu.ports[2] &= ~(1 << 4);
-                        break;
-
-                    case 'q':  // Quit
-                        exit(0);
-                        break;
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "r:p:f:csh")) != -1) {
+        switch (opt) {
+            case 'r': movie_name = optarg; break;
+            case 'p': movie_name = optarg; playing = 1; break;
+            case 'c': color = 1; break;
+            case 's': scanlines = 1; break;
+            case 'f':
+                speed = atol(optarg);
+                if (speed < 0) {
+                    usage(argv[0]);
                 }
                 break;
-
-            case SDL_QUIT:
-                exit(0);
-                break;
+            default: usage(argv[0]);
         }
     }
-}
-
-
-void generate_interrupt(uint16_t addr) {
-    cpu_push(cpu.pc);
-    cpu.pc = addr;
-    cpu.flags.i = 0;
-}
-
 
-void emulate_shift_register() {
-    static uint16_t shift_register;
-    static int shift_amount;
+    init();  // Init 8080 and SDL
+    emu_load_rom(emu, "invaders.rom");
 
-    if (cpu.ir == 0xd3) { // OUT
-        if (ram->mem[cpu.pc] == 2) { // Set shift amount
-            shift_amount = cpu.a;
-        } else if (ram->mem[cpu.pc] == 4) { // Set data in shift register
-            shift_register = (cpu.a << 8) | (shift_register >> 8);
-        }
-    } else if (cpu.ir == 0xdb) { // IN
-        if (ram->mem[cpu.pc] == 3) { // Shift and read data
-            cpu.a = shift_register >> (8 - shift_amount);
+    if (playing) {
+        movie = movie_load(movie_name);
+        if (!movie) {
+            printf("Could not load movie: %s\n", movie_name);
+            exit(1);
         }
+    } else if (movie_name) {
+        movie = movie_new();
+        atexit(save_movie);
     }
-}
-
 
-void cpu_run(long cycles) {
-    int i = 0;
-    while (i < cycles) {
-        cpu_fetch();
-
-        emulate_shift_register();
-
-        int c;
-        if ((c = cpu_run_instruction())) {
-            i += c;
+    pthread_t emulator;
+    pthread_create(&emulator, NULL, run_emulator, NULL);
+
+    // Sleep until an event or a frame comes, and present the newest frame
+    // whenever there is one, but never faster than the display refreshes: a
+    // frame that comes too early waits until the next refresh is due.
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t min_interval = frequency / refresh_rate * 7 / 8;
+    uint64_t presented = 0;
+    while (!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+        SDL_Event ev;
+        uint64_t since = SDL_GetPerformanceCounter() - presented;
+        int got;
+        if (!frame_waiting()) {
+            got = SDL_WaitEvent(&ev);
+        } else if (since < min_interval) {
+            got = SDL_WaitEventTimeout(&ev, (min_interval - since) * 1000 / frequency + 1);
         } else {
-            die();
+            got = SDL_PollEvent(&ev);
         }
-    }
-}
 
+        if (got) {
+            do {
+                if (ev.type != frame_event) {
+                    handle_event(&ev);
+                }
+            } while (SDL_PollEvent(&ev));
+        }
 
-int main() {
-    init();  // Init 8080 and SDL
-    load_rom(ram, "invaders.rom");
-
-    uint32_t last_tic = SDL_GetTicks();  // milliseconds
-    while (1) {
-        if ((SDL_GetTicks() - last_tic) >= TIC) {
-            last_tic = SDL_GetTicks();
-
-            cpu_run(CYCLES_PER_TIC / 2);
-
-            if (cpu.flags.i) {
-                generate_interrupt(0x08);
-            }
-
-            cpu_run(CYCLES_PER_TIC / 2);
-
-            handle_input();
-            draw_video_ram();
-
-            if (cpu.flags.i) {
-                generate_interrupt(0x10);
-            }
-
-            if (SDL_GetTicks() - last_tic > TIC) {
-                puts("Too slow!");
-            }
+        uint64_t now = SDL_GetPerformanceCounter();
+        if (now - presented < min_interval && !resizef) {
+            continue;
+        }
+        if (acquire_frame() || resizef) {
+            draw_video_ram(frames[front].vram);
+            presented = now;
         }
     }
 
+    pthread_join(emulator, NULL);
+
     return 0;
 }
@@ -0,0 +1,1084 @@
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "disassembler.h"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+#include <cpuid.h>
+
+/*
+ * x86-64 dynamic recompiler
+ *
+ * Basic blocks of ROM code are translated into native code the first time
+ * they run, and cached by their 8080 entry address. Translated code keeps
+ * the 8080 registers in x86 ones, in the pairs they were designed after:
+ *
+ *   al  A        bx  HL (bh H, bl L)
+ *   ah  F        cx  BC (ch B, cl C)
+ *   si  SP       dx  DE (dh D, dl E)
+ *
+ * so most instructions become one to four x86 instructions. They are only
+ * stored back into struct cpu around calls into C and when going back to
+ * jit_run(). The 8080 status register has the layout of the low byte of
+ * RFLAGS: S, Z, AC, P and CY sit where SF, ZF, AF, PF and CF do. Arithmetic
+ * and logic use the x86 instruction of the same name and LAHF copies the
+ * flags into F, masked to the ones the instruction sets; SAHF brings the
+ * carry in for ADC, SBB, INR and DCR. Only AC needs fixing up: the 8080
+ * sets it on no borrow when subtracting, and from bit 3 of the operands on
+ * ANA. Bits 1, 3 and 5 of F are always clear (POP PSW masks them).
+ *
+ * Memory is read through mem->read_page and written through
+ * mem->write_page. Writes to pages without a fast path (ROM, watched code,
+ * handlers, the write log) call mem_write_slow() from out of line code at
+ * the end of the block. Only IN, OUT, EI, DI, HLT, DAA and XTHL still call
+ * their interpreter handler, so the semantics never diverge.
+ *
+ * Conditional jumps, calls and returns test F and branch natively. An exit
+ * to a known address jumps straight to the block there, patched in once
+ * that block is translated. The other exits (returns, PCHL, handlers that
+ * jump) look the next block up by its address without going back to C.
+ *
+ * A block only runs when the budget covers its worst case, checked on entry,
+ * so it never runs past the deadline: the JIT stops after the same
+ * instruction cpu_run() would, and interrupts are taken on the same cycle.
+ * Close to the deadline, the instructions no block fits are interpreted.
+ *
+ * The other host registers hold:
+ *
+ *   rbp  struct cpu *
+ *   r11  instructions run, not yet added to cpu->instructions
+ *   r12  cycles left in the budget
+ *   r13  mem->read_page, followed by mem->write_page
+ *   r14  &jit->invalidated
+ *   r15  jit->blocks
+ *
+ * and rdi, r8, r9 and r10 are scratch. Code outside the ROM, or starting
+ * with an unimplemented opcode, is run by the interpreter. A write to any
+ * translated byte flushes the whole cache: the running block stops right
+ * after the instruction that did the write, and everything is translated
+ * again from the new memory contents.
+ */
+
+#define CODE_SIZE (1 << 20)   // Bytes of native code before the cache is flushed
+#define BLOCK_SLACK 32768     // Room always left for one more block
+#define MAX_BLOCK 64          // 8080 instructions per block, see JIT_MAX_CYCLES
+#define MAX_COLD (4 * MAX_BLOCK)  // Out of line sequences per block
+#define MAX_LINKS 65536       // Exits waiting for their target to be translated
+
+#define CPU(field) ((int) offsetof(struct cpu, field))
+#define WRITE_PAGES (offsetof(mem_t, write_page) - offsetof(mem_t, read_page))
+
+// Out of line code, see emit_cold_code()
+typedef enum {
+    COLD_WRITE,     // mem_write_slow(), then back to resume
+    COLD_EXIT,      // Back to jit_run() with pc in cpu->pc
+    COLD_DISPATCH,  // On to the block at pc, until it is translated
+} cold_kind_t;
+
+typedef struct {
+    cold_kind_t kind;
+    uint8_t *jump;    // rel32 of the jump to it
+    uint8_t *resume;
+    int value;        // Register written, or -1 for imm
+    int cycles;       // Still to account for
+    int instructions;
+    int ir, z, w;     // Latches still to store
+    uint16_t imm;
+    uint16_t pc;
+} cold_t;
+
+struct jit {
+    struct cpu *cpu;
+
+    uint8_t *code;  // Executable buffer
+    uint8_t *ptr;   // Where the next block goes
+    uint8_t *start; // First byte after the fixed stubs
+
+    long (*enter)(struct cpu *cpu, const uint8_t *block, long budget);
+    uint8_t *dispatch;    // Find and jump to the block at di
+    uint8_t *exit;        // Return to jit_run()
+    uint8_t *write_slow;  // Call mem_write_slow(), arguments set
+
+    uint8_t *blocks[JIT_END];  // Translated code by entry address
+    uint16_t block_cycles[JIT_END];  // Worst case of each
+    uint8_t invalidated;
+    int native_loads;  // Whether every page can be read through read_page
+
+    // Exits to untranslated code, by target address, patched to jump
+    // straight there once it is translated
+    int link_head[JIT_END];
+    struct {
+        uint8_t *jump;
+        int next;
+    } links[MAX_LINKS];
+    int link_count;
+
+    // Block being translated
+    int cycles;        // Not yet taken off the budget
+    int instructions;  // Not yet added to r11
+    int ir, z, w;      // IR, Z and W as cpu_fetch() would leave them, not yet
+                       // stored, or -1 if struct cpu has them
+    cold_t cold[MAX_COLD];
+    int cold_count;
+};
+
+
+/*
+ * Instruction metadata
+ */
+
+// Instructions that leave pc somewhere else than the next instruction
+static int op_ends_block(uint8_t op) {
+    return disasm_ops[op].flow != DISASM_NEXT;
+}
+
+// Instructions that read memory, only translated while every page can be
+// read through read_page
+static int op_reads_memory(uint8_t op) {
+    int flow = disasm_ops[op].flow;
+
+    return (op & 0xc7) == 0x46 ||  // MOV r, M
+           (op & 0xc7) == 0x86 ||  // ALU M
+           (op & 0xcf) == 0xc1 ||  // POP
+           op == 0x34 || op == 0x35 || op == 0x0a || op == 0x1a || op == 0x2a || op == 0x3a ||
+           flow == DISASM_RETURN || flow == DISASM_COND_RETURN;
+}
+
+// x86 registers, as ModRM fields. The 8-bit ones 4 to 7 are ah, ch, dh and
+// bh, which only exist without a REX prefix; R9 is r9b, which needs one.
+#define AL 0
+#define CL 1
+#define DL 2
+#define BL 3
+#define AH 4
+#define CH 5
+#define DH 6
+#define BH 7
+#define R9 9
+
+#define ECX 1
+#define EDX 2
+#define EBX 3
+#define ESI 6
+#define EDI 7
+
+// Host registers of B, C, D, E, H, L, (M), A in the order of the opcode
+// bit fields
+static const int reg8[8] = { CH, CL, DH, DL, BH, BL, -1, AL };
+
+// Host registers of BC, DE, HL, SP in the order of the opcode bit fields,
+// and the high and low halves of the first three
+static const int reg16[4] = { ECX, EDX, EBX, ESI };
+static const int reg_high[3] = { CH, DH, BH };
+static const int reg_low[3] = { CL, DL, BL };
+
+// The /digit of the x86 instruction for ADD, ADC, SUB, SBB, ANA, XRA, ORA
+// and CMP, in the order of the opcode bit fields
+static const uint8_t alu_x86[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+
+// Flag tested by the conditions NZ/Z, NC/C, PO/PE, P/M
+static const uint8_t cond_flag[4] = { f_z, f_cy, f_p, f_s };
+
+
+/*
+ * Emitter
+ */
+
+static void emit8(jit_t *jit, uint8_t b) {
+    *jit->ptr++ = b;
+}
+
+static void emit16(jit_t *jit, uint16_t w) {
+    memcpy(jit->ptr, &w, 2);
+    jit->ptr += 2;
+}
+
+static void emit32(jit_t *jit, uint32_t d) {
+    memcpy(jit->ptr, &d, 4);
+    jit->ptr += 4;
+}
+
+static void emit64(jit_t *jit, uint64_t q) {
+    memcpy(jit->ptr, &q, 8);
+    jit->ptr += 8;
+}
+
+// Opcode bytes followed by a [rbp + disp] ModRM with the given reg field
+static void emit_rbp(jit_t *jit, const char *ops, int n, int reg, int disp) {
+    for (int i = 0; i < n; i++) {
+        emit8(jit, ops[i]);
+    }
+    if (disp >= -128 && disp < 128) {
+        emit8(jit, 0x45 | (reg & 7) << 3);
+        emit8(jit, disp);
+    } else {
+        emit8(jit, 0x85 | (reg & 7) << 3);
+        emit32(jit, disp);
+    }
+}
+
+// Point the rel32 at jump to the current position
+static void patch_here(jit_t *jit, uint8_t *jump) {
+    int32_t rel = jit->ptr - (jump + 4);
+    memcpy(jump, &rel, 4);
+}
+
+// jmp/jcc rel32 to target. cc < 0 for an unconditional jump.
+static void emit_jump(jit_t *jit, int cc, const uint8_t *target) {
+    if (cc < 0) {
+        emit8(jit, 0xe9);
+    } else {
+        emit8(jit, 0x0f);
+        emit8(jit, 0x80 | cc);
+    }
+    emit32(jit, target - (jit->ptr + 4));
+}
+
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_AE 0x3
+#define CC_L  0xc
+
+// jmp/jcc rel32 to out of line code of the given kind, see emit_cold_code()
+static cold_t *emit_cold(jit_t *jit, int cc, cold_kind_t kind, uint16_t pc) {
+    if (cc < 0) {
+        emit8(jit, 0xe9);
+    } else {
+        emit8(jit, 0x0f);
+        emit8(jit, 0x80 | cc);
+    }
+    emit32(jit, 0);
+
+    cold_t *c = &jit->cold[jit->cold_count++];
+    *c = (cold_t) { kind, jit->ptr - 4, NULL, -1, jit->cycles, jit->instructions,
+                    jit->ir, jit->z, jit->w, 0, pc };
+    return c;
+}
+
+// Store the 8080 registers into struct cpu, and the instruction count
+static void emit_spill(jit_t *jit) {
+    emit_rbp(jit, "\x88", 1, AL, CPU(a));       // mov [rbp + a], al
+    emit_rbp(jit, "\x88", 1, AH, CPU(f));       // mov [rbp + f], ah
+    emit_rbp(jit, "\x66\x89", 2, EBX, CPU(hl));  // mov [rbp + hl], bx
+    emit_rbp(jit, "\x66\x89", 2, ECX, CPU(bc));  // mov [rbp + bc], cx
+    emit_rbp(jit, "\x66\x89", 2, EDX, CPU(de));  // mov [rbp + de], dx
+    emit_rbp(jit, "\x66\x89", 2, ESI, CPU(sp));  // mov [rbp + sp], si
+    emit_rbp(jit, "\x4c\x01", 2, 3, CPU(instructions));  // add [rbp + instructions], r11
+}
+
+// Load the 8080 registers from struct cpu
+static void emit_reload(jit_t *jit) {
+    emit_rbp(jit, "\x0f\xb7", 2, EBX, CPU(hl));  // movzx ebx, word [rbp + hl]
+    emit_rbp(jit, "\x0f\xb7", 2, ECX, CPU(bc));  // movzx ecx, word [rbp + bc]
+    emit_rbp(jit, "\x0f\xb7", 2, EDX, CPU(de));  // movzx edx, word [rbp + de]
+    emit_rbp(jit, "\x0f\xb7", 2, ESI, CPU(sp));  // movzx esi, word [rbp + sp]
+    emit_rbp(jit, "\x8a", 1, AL, CPU(a));       // mov al, [rbp + a]
+    emit_rbp(jit, "\x8a", 1, AH, CPU(f));       // mov ah, [rbp + f]
+    emit8(jit, 0x45); emit8(jit, 0x31); emit8(jit, 0xdb);  // xor r11d, r11d
+}
+
+// movzx edi, r16: the address in a register pair
+static void emit_address(jit_t *jit, int reg) {
+    emit8(jit, 0x0f); emit8(jit, 0xb7); emit8(jit, 0xf8 | reg);
+}
+
+// mov edi, imm32
+static void emit_address_imm(jit_t *jit, uint16_t addr) {
+    emit8(jit, 0xbf); emit32(jit, addr);
+}
+
+// lea edi, [rsi + offset]: an address relative to SP, only the low 16 bits
+// of which count
+static void emit_address_sp(jit_t *jit, int offset) {
+    emit8(jit, 0x8d); emit8(jit, 0x7e); emit8(jit, offset);
+}
+
+// r8 = the read or write page of the address in di
+static void emit_page(jit_t *jit, int write) {
+    emit8(jit, 0x44); emit8(jit, 0x0f); emit8(jit, 0xb7); emit8(jit, 0xc7);  // movzx r8d, di
+    emit8(jit, 0x41); emit8(jit, 0xc1); emit8(jit, 0xe8); emit8(jit, 0x08);  // shr r8d, 8
+    emit8(jit, 0x4f); emit8(jit, 0x8b);                                      // mov r8, [r13 + r8*8 + disp]
+    if (write) {
+        emit8(jit, 0x84); emit8(jit, 0xc5); emit32(jit, WRITE_PAGES);
+    } else {
+        emit8(jit, 0x44); emit8(jit, 0xc5); emit8(jit, 0x00);
+    }
+}
+
+// rdi = host address of the 8080 address in di, on a page that has one
+static void emit_offset(jit_t *jit) {
+    emit8(jit, 0x40); emit8(jit, 0x0f); emit8(jit, 0xb6); emit8(jit, 0xff);  // movzx edi, dil
+    emit8(jit, 0x4c); emit8(jit, 0x01); emit8(jit, 0xc7);                    // add rdi, r8
+}
+
+// Point rdi at the memory at the address in di, for reading
+static void emit_load_pointer(jit_t *jit) {
+    emit_page(jit, 0);
+    emit_offset(jit);
+}
+
+// mov r8, [rdi]
+static void emit_load(jit_t *jit, int reg) {
+    if (reg >= 8) {
+        emit8(jit, 0x44);
+    }
+    emit8(jit, 0x8a); emit8(jit, (reg & 7) << 3 | 7);
+}
+
+// Write reg, or imm if reg < 0, to the address in di: straight through
+// write_page, or with mem_write_slow() out of line when the page has no fast
+// path. Clobbers rdi and r8.
+static void emit_store(jit_t *jit, int reg, uint8_t imm) {
+    emit_page(jit, 1);
+    emit8(jit, 0x4d); emit8(jit, 0x85); emit8(jit, 0xc0);  // test r8, r8
+    cold_t *slow = emit_cold(jit, CC_E, COLD_WRITE, 0);
+    slow->value = reg;
+    slow->imm = imm;
+
+    emit_offset(jit);
+    if (reg < 0) {
+        emit8(jit, 0xc6); emit8(jit, 0x07); emit8(jit, imm);  // mov byte [rdi], imm8
+    } else {
+        if (reg >= 8) {
+            emit8(jit, 0x44);
+        }
+        emit8(jit, 0x88); emit8(jit, (reg & 7) << 3 | 7);  // mov [rdi], r8
+    }
+    slow->resume = jit->ptr;
+}
+
+// Leave, with pc in cpu->pc, if the instruction just translated wrote over
+// translated code
+static void emit_check_code_write(jit_t *jit, uint16_t pc) {
+    emit8(jit, 0x41); emit8(jit, 0x80); emit8(jit, 0x3e); emit8(jit, 0x00);  // cmp byte [r14], 0
+    emit_cold(jit, CC_NE, COLD_EXIT, pc);
+}
+
+// Push high then low, registers or imm where < 0, as cpu_push() does: the
+// high byte to SP - 1, the low one to SP - 2. A low of R9 is F as
+// PUSH_PSW() pushes it, with bit 1 set, worked out once the high byte is
+// stored as the slow path of that store clobbers r9.
+static void emit_push(jit_t *jit, int high, int low, uint16_t imm) {
+    emit_address_sp(jit, -1);
+    emit_store(jit, high, imm >> 8);
+    if (low == R9) {
+        emit8(jit, 0x41); emit8(jit, 0x89); emit8(jit, 0xc1);  // mov r9d, eax
+        emit8(jit, 0x41); emit8(jit, 0xc1); emit8(jit, 0xe9); emit8(jit, 0x08);  // shr r9d, 8
+        emit8(jit, 0x41); emit8(jit, 0x83); emit8(jit, 0xe1); emit8(jit, F_ALL);  // and r9d, F_ALL
+        emit8(jit, 0x41); emit8(jit, 0x83); emit8(jit, 0xc9); emit8(jit, 0x02);  // or r9d, 2
+    }
+    emit_address_sp(jit, -2);
+    emit_store(jit, low, imm);
+    emit8(jit, 0x66); emit8(jit, 0x83); emit8(jit, 0xee); emit8(jit, 0x02);  // sub si, 2
+}
+
+// Pop into di, as cpu_pop() does
+static void emit_pop_address(jit_t *jit) {
+    emit_address(jit, ESI);
+    emit_load_pointer(jit);
+    emit8(jit, 0x44); emit8(jit, 0x0f); emit8(jit, 0xb6); emit8(jit, 0x0f);  // movzx r9d, byte [rdi]
+    emit_address_sp(jit, 1);
+    emit_load_pointer(jit);
+    emit8(jit, 0x44); emit8(jit, 0x0f); emit8(jit, 0xb6); emit8(jit, 0x17);  // movzx r10d, byte [rdi]
+    emit8(jit, 0x66); emit8(jit, 0x83); emit8(jit, 0xc6); emit8(jit, 0x02);  // add si, 2
+    emit8(jit, 0x41); emit8(jit, 0xc1); emit8(jit, 0xe2); emit8(jit, 0x08);  // shl r10d, 8
+    emit8(jit, 0x45); emit8(jit, 0x09); emit8(jit, 0xca);                    // or r10d, r9d
+    emit8(jit, 0x44); emit8(jit, 0x89); emit8(jit, 0xd7);                    // mov edi, r10d
+}
+
+// The ALU instruction in bits 3-5 of op on A and the operand, then F from
+// the x86 flags. The operand is reg, [rdi] if reg < 0 and op is not an
+// immediate form, imm otherwise.
+static void emit_alu(jit_t *jit, uint8_t op, int reg, uint8_t imm) {
+    int alu = (op >> 3) & 7;
+    int x86 = alu_x86[alu];
+    int immediate = (op & 0xc0) == 0xc0;
+
+    if (alu == 4) {
+        // ANA sets AC to bit 3 of either operand, kept in edi or r9d
+        if (immediate) {
+            emit8(jit, 0x89); emit8(jit, 0xc7);  // mov edi, eax
+            emit8(jit, 0x81); emit8(jit, 0xcf); emit32(jit, imm);  // or edi, imm32
+        } else if (reg < 0) {
+            emit8(jit, 0x44); emit8(jit, 0x0f); emit8(jit, 0xb6); emit8(jit, 0x0f);  // movzx r9d, byte [rdi]
+            emit8(jit, 0x41); emit8(jit, 0x09); emit8(jit, 0xc1);  // or r9d, eax
+        } else {
+            emit8(jit, 0x0f); emit8(jit, 0xb6); emit8(jit, 0xf8 | reg);  // movzx edi, r8
+            emit8(jit, 0x09); emit8(jit, 0xc7);  // or edi, eax
+        }
+    }
+    if (alu == 1 || alu == 3) {
+        emit8(jit, 0x9e);  // sahf, CY in for ADC and SBB
+    }
+
+    if (immediate) {
+        emit8(jit, x86 << 3 | 4); emit8(jit, imm);  // op al, imm8
+    } else if (reg < 0) {
+        emit8(jit, x86 << 3 | 2); emit8(jit, 0x07);  // op al, [rdi]
+    } else {
+        emit8(jit, x86 << 3); emit8(jit, 0xc0 | reg << 3);  // op al, r8
+    }
+
+    emit8(jit, 0x9f);  // lahf
+    if (alu == 2 || alu == 3 || alu == 7) {
+        emit8(jit, 0x80); emit8(jit, 0xf4); emit8(jit, f_ac);  // xor ah, f_ac
+    }
+    if (alu >= 4 && alu <= 6) {
+        emit8(jit, 0x80); emit8(jit, 0xe4); emit8(jit, F_ZSP);  // and ah, F_ZSP
+    } else {
+        emit8(jit, 0x80); emit8(jit, 0xe4); emit8(jit, F_ALL);  // and ah, F_ALL
+    }
+
+    if (alu == 4) {
+        int r9 = !immediate && reg < 0;
+        if (r9) {
+            emit8(jit, 0x41); emit8(jit, 0x83); emit8(jit, 0xe1); emit8(jit, 0x08);  // and r9d, 8
+            emit8(jit, 0x41); emit8(jit, 0xc1); emit8(jit, 0xe1); emit8(jit, 0x09);  // shl r9d, 9
+            emit8(jit, 0x44); emit8(jit, 0x09); emit8(jit, 0xc8);                    // or eax, r9d
+        } else {
+            emit8(jit, 0x83); emit8(jit, 0xe7); emit8(jit, 0x08);  // and edi, 8
+            emit8(jit, 0xc1); emit8(jit, 0xe7); emit8(jit, 0x09);  // shl edi, 9
+            emit8(jit, 0x09); emit8(jit, 0xf8);                    // or eax, edi
+        }
+    }
+}
+
+// INR or DCR of reg, F from the x86 flags. CY is kept.
+static void emit_inr_dcr(jit_t *jit, int dcr, int reg) {
+    emit8(jit, 0x9e);  // sahf
+    if (reg >= 8) {
+        emit8(jit, 0x41);
+    }
+    emit8(jit, 0xfe); emit8(jit, 0xc0 | dcr << 3 | (reg & 7));  // inc/dec r8
+    emit8(jit, 0x9f);  // lahf
+    if (dcr) {
+        emit8(jit, 0x80); emit8(jit, 0xf4); emit8(jit, f_ac);  // xor ah, f_ac
+    }
+    emit8(jit, 0x80); emit8(jit, 0xe4); emit8(jit, F_ALL);  // and ah, F_ALL
+}
+
+// test ah, flag and a jump, to be patched, taken when the condition in bits
+// 3-5 of op does not hold
+static uint8_t *emit_unless(jit_t *jit, uint8_t op) {
+    emit8(jit, 0xf6); emit8(jit, 0xc4); emit8(jit, cond_flag[op >> 4 & 3]);  // test ah, flag
+    emit8(jit, 0x0f); emit8(jit, 0x80 | (op & 8 ? CC_E : CC_NE));
+    emit32(jit, 0);
+    return jit->ptr - 4;
+}
+
+// Account for the cycles and instructions translated so far, and store the
+// latches, so that struct cpu is what the interpreter would leave
+static void emit_flush(jit_t *jit) {
+    if (jit->ir >= 0) {
+        emit_rbp(jit, "\xc6", 1, 0, CPU(ir));  // mov byte [rbp + ir], imm8
+        emit8(jit, jit->ir);
+    }
+    if (jit->w >= 0) {
+        emit_rbp(jit, "\x66\xc7", 2, 0, CPU(wz));  // mov word [rbp + wz], imm16
+        emit16(jit, jit->z | jit->w << 8);
+    } else if (jit->z >= 0) {
+        emit_rbp(jit, "\xc6", 1, 0, CPU(z));  // mov byte [rbp + z], imm8
+        emit8(jit, jit->z);
+    }
+    if (jit->instructions) {
+        emit8(jit, 0x49); emit8(jit, 0x83); emit8(jit, 0xc3); emit8(jit, jit->instructions);  // add r11, imm8
+        jit->instructions = 0;
+    }
+    if (jit->cycles) {
+        emit8(jit, 0x49); emit8(jit, 0x81); emit8(jit, 0xec); emit32(jit, jit->cycles);  // sub r12, imm32
+        jit->cycles = 0;
+    }
+}
+
+// Go on at target: straight to its block if translated, once it is if below
+// JIT_END, through dispatch otherwise. Blocks check the budget themselves.
+static void emit_exit(jit_t *jit, uint16_t target) {
+    emit_flush(jit);
+
+    if (target < JIT_END && jit->blocks[target]) {
+        emit_jump(jit, -1, jit->blocks[target]);
+        return;
+    }
+
+    emit_cold(jit, -1, COLD_DISPATCH, target);
+    if (target < JIT_END && jit->link_count < MAX_LINKS) {
+        int i = jit->link_count++;
+        jit->links[i].jump = jit->ptr - 4;
+        jit->links[i].next = jit->link_head[target];
+        jit->link_head[target] = i;
+    }
+}
+
+// Find and jump to the block at di, back to C when there is none. Inlined at
+// every exit whose target is only known at run time, so that each gets its
+// own indirect jump to predict.
+static void emit_dispatch(jit_t *jit) {
+    emit_rbp(jit, "\x66\x89", 2, EDI, CPU(pc));  // mov [rbp + pc], di
+    emit8(jit, 0x0f); emit8(jit, 0xb7); emit8(jit, 0xff);  // movzx edi, di
+    emit8(jit, 0x81); emit8(jit, 0xff); emit32(jit, JIT_END);  // cmp edi, JIT_END
+    emit_jump(jit, CC_AE, jit->exit);
+    emit8(jit, 0x49); emit8(jit, 0x8b); emit8(jit, 0x3c); emit8(jit, 0xff);  // mov rdi, [r15 + rdi*8]
+    emit8(jit, 0x48); emit8(jit, 0x85); emit8(jit, 0xff);  // test rdi, rdi
+    emit_jump(jit, CC_E, jit->exit);
+    emit8(jit, 0xff); emit8(jit, 0xe7);  // jmp rdi
+}
+
+// Go on at the address in di
+static void emit_exit_dynamic(jit_t *jit) {
+    emit_flush(jit);
+    emit_dispatch(jit);
+}
+
+// The out of line code of the block, after its last exit
+static void emit_cold_code(jit_t *jit) {
+    for (int i = 0; i < jit->cold_count; i++) {
+        cold_t *c = &jit->cold[i];
+        patch_here(jit, c->jump);
+
+        switch (c->kind) {
+            case COLD_WRITE:
+                emit_spill(jit);
+                if (c->value < 0) {
+                    emit8(jit, 0xba); emit32(jit, c->imm);  // mov edx, imm32
+                } else {
+                    if (c->value >= 8) {
+                        emit8(jit, 0x41);
+                    }
+                    emit8(jit, 0x0f); emit8(jit, 0xb6); emit8(jit, 0xd0 | (c->value & 7));  // movzx edx, r8
+                }
+                emit8(jit, 0x0f); emit8(jit, 0xb7); emit8(jit, 0xf7);  // movzx esi, di
+                emit_rbp(jit, "\x48\x8b", 2, EDI, CPU(mem));  // mov rdi, [rbp + mem]
+                emit8(jit, 0xe8); emit32(jit, jit->write_slow - (jit->ptr + 4));  // call write_slow
+                emit_reload(jit);
+                emit_jump(jit, -1, c->resume);
+                break;
+
+            case COLD_EXIT:
+                jit->cycles = c->cycles;
+                jit->instructions = c->instructions;
+                jit->ir = c->ir;
+                jit->z = c->z;
+                jit->w = c->w;
+                emit_flush(jit);
+                emit_rbp(jit, "\x66\xc7", 2, 0, CPU(pc));  // mov word [rbp + pc], imm16
+                emit16(jit, c->pc);
+                emit_jump(jit, -1, jit->exit);
+                break;
+
+            case COLD_DISPATCH:
+                emit8(jit, 0xbf); emit32(jit, c->pc);  // mov edi, pc
+                emit_jump(jit, -1, jit->dispatch);
+                break;
+        }
+    }
+
+    jit->cold_count = 0;
+}
+
+// Run one instruction through its interpreter handler, with IR, WZ and PC
+// loaded the way cpu_fetch() would
+static void emit_call(jit_t *jit, const uint8_t *code, uint16_t pc, cpu_handler_t handler) {
+    int length = cpu_length(code[0]);
+
+    emit_flush(jit);
+    jit->ir = jit->z = jit->w = -1;
+
+    emit_spill(jit);
+    emit8(jit, 0x48); emit8(jit, 0x89); emit8(jit, 0xef);  // mov rdi, rbp
+    emit_rbp(jit, "\x66\xc7", 2, 0, CPU(pc));  // mov word [rbp + pc], imm16
+    emit16(jit, pc + length);
+    emit8(jit, 0x48); emit8(jit, 0xb8);  // mov rax, handler
+    emit64(jit, (uint64_t) (uintptr_t) handler);
+    emit8(jit, 0xff); emit8(jit, 0xd0);  // call rax
+    emit8(jit, 0x89); emit8(jit, 0xc0);  // mov eax, eax
+    emit8(jit, 0x49); emit8(jit, 0x29); emit8(jit, 0xc4);  // sub r12, rax
+    emit_reload(jit);
+
+    // Leave if the handler wrote over translated code
+    emit8(jit, 0x41); emit8(jit, 0x80); emit8(jit, 0x3e); emit8(jit, 0x00);  // cmp byte [r14], 0
+    emit_jump(jit, CC_NE, jit->exit);
+}
+
+// Translate an instruction that ends the block, emitting its exits
+static void emit_transfer(jit_t *jit, const uint8_t *code, uint16_t pc) {
+    uint8_t op = code[0];
+    const disasm_op_t *d = &disasm_ops[op];
+    uint16_t imm = code[1] | code[2] << 8;
+    uint16_t next = pc + d->length;
+
+    // Conditional instructions go on at next, with what was accounted for
+    // before the test, unless the condition holds
+    uint8_t *skip = NULL;
+    int cycles = jit->cycles;
+    int instructions = jit->instructions;
+    if (d->flow == DISASM_BRANCH || d->cycles_taken != d->cycles) {
+        skip = emit_unless(jit, op);
+        jit->cycles += d->cycles_taken - d->cycles;
+    }
+
+    switch (d->flow) {
+        case DISASM_JUMP:
+        case DISASM_BRANCH:
+            emit_exit(jit, imm);
+            break;
+
+        case DISASM_CALL:
+        case DISASM_RST: {
+            uint16_t target = d->flow == DISASM_RST ? op & 0x38 : imm;
+            emit_push(jit, -1, -1, next);
+            emit_check_code_write(jit, target);
+            emit_exit(jit, target);
+            break;
+        }
+
+        case DISASM_RETURN:
+        case DISASM_COND_RETURN:
+            emit_pop_address(jit);
+            emit_exit_dynamic(jit);
+            break;
+
+        case DISASM_PCHL:
+            emit_address(jit, EBX);
+            emit_exit_dynamic(jit);
+            break;
+    }
+
+    if (skip) {
+        patch_here(jit, skip);
+        jit->cycles = cycles;
+        jit->instructions = instructions;
+        emit_exit(jit, next);
+    }
+}
+
+// Translate op natively if it does not need its handler. Returns 0 if it
+// does, having emitted nothing.
+static int emit_native(jit_t *jit, const uint8_t *code, uint16_t pc) {
+    uint8_t op = code[0];
+    const disasm_op_t *d = &disasm_ops[op];
+    uint16_t imm = code[1] | code[2] << 8;
+    uint16_t next = pc + d->length;
+    int dst = reg8[(op >> 3) & 7];
+    int src = reg8[op & 7];
+    int rp = (op >> 4) & 3;
+
+    switch (op) {
+        case 0x27: case 0x76: case 0xd3: case 0xdb: case 0xe3: case 0xf3: case 0xfb:
+            return 0;  // DAA, HLT, OUT, IN, XTHL, DI, EI
+    }
+    if (!jit->native_loads && op_reads_memory(op)) {
+        return 0;
+    }
+
+    // Conditional instructions take the difference if the condition holds
+    jit->cycles += d->cycles;
+
+    if (op_ends_block(op)) {
+        emit_transfer(jit, code, pc);
+        return 1;
+    }
+
+    if ((op & 0xc7) == 0x00) {  // NOP
+        return 1;
+    }
+    if ((op & 0xc0) == 0x40) {  // MOV
+        if (dst < 0) {
+            emit_address(jit, EBX);
+            emit_store(jit, src, 0);
+            emit_check_code_write(jit, next);
+        } else if (src < 0) {
+            emit_address(jit, EBX);
+            emit_load_pointer(jit);
+            emit_load(jit, dst);
+        } else {
+            emit8(jit, 0x88); emit8(jit, 0xc0 | src << 3 | dst);  // mov r8, r8
+        }
+        return 1;
+    }
+    if ((op & 0xc0) == 0x80 || (op & 0xc7) == 0xc6) {  // ALU r, M and immediate
+        if ((op & 0xc0) == 0x80 && src < 0) {
+            emit_address(jit, EBX);
+            emit_load_pointer(jit);
+        }
+        emit_alu(jit, op, src, code[1]);
+        return 1;
+    }
+    if ((op & 0xc7) == 0x06) {  // MVI
+        if (dst < 0) {
+            emit_address(jit, EBX);
+            emit_store(jit, -1, code[1]);
+            emit_check_code_write(jit, next);
+        } else {
+            emit8(jit, 0xb0 | dst); emit8(jit, code[1]);  // mov r8, imm8
+        }
+        return 1;
+    }
+    if ((op & 0xc6) == 0x04) {  // INR, DCR
+        if (dst < 0) {
+            emit_address(jit, EBX);
+            emit_load_pointer(jit);
+            emit8(jit, 0x44); emit8(jit, 0x0f); emit8(jit, 0xb6); emit8(jit, 0x0f);  // movzx r9d, byte [rdi]
+            emit_inr_dcr(jit, op & 1, R9);
+            emit_address(jit, EBX);
+            emit_store(jit, R9, 0);
+            emit_check_code_write(jit, next);
+        } else {
+            emit_inr_dcr(jit, op & 1, dst);
+        }
+        return 1;
+    }
+
+    switch (op & 0xcf) {
+        case 0x01:  // LXI
+            emit8(jit, 0x66); emit8(jit, 0xb8 | reg16[rp]); emit16(jit, imm);  // mov r16, imm16
+            return 1;
+        case 0x03:  // INX
+            emit8(jit, 0x66); emit8(jit, 0xff); emit8(jit, 0xc0 | reg16[rp]);  // inc r16
+            return 1;
+        case 0x0b:  // DCX
+            emit8(jit, 0x66); emit8(jit, 0xff); emit8(jit, 0xc8 | reg16[rp]);  // dec r16
+            return 1;
+        case 0x09:  // DAD, CY from the x86 carry rotated into F
+            emit8(jit, 0xd0); emit8(jit, 0xec);  // shr ah, 1
+            emit8(jit, 0x66); emit8(jit, 0x01); emit8(jit, 0xc3 | reg16[rp] << 3);  // add bx, r16
+            emit8(jit, 0xd0); emit8(jit, 0xd4);  // rcl ah, 1
+            return 1;
+        case 0xc5:  // PUSH
+            if (rp == 3) {
+                emit_push(jit, AL, R9, 0);
+            } else {
+                emit_push(jit, reg_high[rp], reg_low[rp], 0);
+            }
+            emit_check_code_write(jit, next);
+            return 1;
+        case 0xc1:  // POP
+            emit_address(jit, ESI);
+            emit_load_pointer(jit);
+            emit_load(jit, rp == 3 ? AH : reg_low[rp]);
+            emit_address_sp(jit, 1);
+            emit_load_pointer(jit);
+            emit_load(jit, rp == 3 ? AL : reg_high[rp]);
+            emit8(jit, 0x66); emit8(jit, 0x83); emit8(jit, 0xc6); emit8(jit, 0x02);  // add si, 2
+            if (rp == 3) {
+                emit8(jit, 0x80); emit8(jit, 0xe4); emit8(jit, F_ALL);  // and ah, F_ALL
+            }
+            return 1;
+    }
+
+    switch (op) {
+        case 0x02: case 0x12:  // STAX
+            emit_address(jit, reg16[rp]);
+            emit_store(jit, AL, 0);
+            emit_check_code_write(jit, next);
+            return 1;
+        case 0x0a: case 0x1a:  // LDAX
+            emit_address(jit, reg16[rp]);
+            emit_load_pointer(jit);
+            emit_load(jit, AL);
+            return 1;
+        case 0x22:  // SHLD
+            emit_address_imm(jit, imm + 1);
+            emit_store(jit, BH, 0);
+            emit_address_imm(jit, imm);
+            emit_store(jit, BL, 0);
+            emit_check_code_write(jit, next);
+            return 1;
+        case 0x2a:  // LHLD
+            emit_address_imm(jit, imm + 1);
+            emit_load_pointer(jit);
+            emit_load(jit, BH);
+            emit_address_imm(jit, imm);
+            emit_load_pointer(jit);
+            emit_load(jit, BL);
+            return 1;
+        case 0x32:  // STA
+            emit_address_imm(jit, imm);
+            emit_store(jit, AL, 0);
+            emit_check_code_write(jit, next);
+            return 1;
+        case 0x3a:  // LDA
+            emit_address_imm(jit, imm);
+            emit_load_pointer(jit);
+            emit_load(jit, AL);
+            return 1;
+        case 0x07: case 0x0f: case 0x17: case 0x1f:  // RLC, RRC, RAL, RAR
+            emit8(jit, 0xd0); emit8(jit, 0xec);  // shr ah, 1, CY into the x86 carry
+            emit8(jit, 0xd0); emit8(jit, 0xc0 | (op & 0x18));  // rol/ror/rcl/rcr al, 1
+            emit8(jit, 0xd0); emit8(jit, 0xd4);  // rcl ah, 1
+            return 1;
+        case 0x2f:  // CMA
+            emit8(jit, 0xf6); emit8(jit, 0xd0);  // not al
+            return 1;
+        case 0x37:  // STC
+            emit8(jit, 0x80); emit8(jit, 0xcc); emit8(jit, f_cy);  // or ah, f_cy
+            return 1;
+        case 0x3f:  // CMC
+            emit8(jit, 0x80); emit8(jit, 0xf4); emit8(jit, f_cy);  // xor ah, f_cy
+            return 1;
+        case 0xeb:  // XCHG
+            emit8(jit, 0x66); emit8(jit, 0x87); emit8(jit, 0xd3);  // xchg bx, dx
+            return 1;
+        case 0xf9:  // SPHL
+            emit8(jit, 0x66); emit8(jit, 0x89); emit8(jit, 0xde);  // mov si, bx
+            return 1;
+    }
+
+    jit->cycles -= d->cycles;
+    return 0;
+}
+
+
+/*
+ * Cache
+ */
+
+static void jit_emit_stubs(jit_t *jit) {
+    jit->ptr = jit->code;
+
+    // long enter(struct cpu *cpu, const uint8_t *block, long budget)
+    jit->enter = (void *) jit->ptr;
+    emit8(jit, 0x53);                                      // push rbx
+    emit8(jit, 0x55);                                      // push rbp
+    emit8(jit, 0x41); emit8(jit, 0x54);                    // push r12
+    emit8(jit, 0x41); emit8(jit, 0x55);                    // push r13
+    emit8(jit, 0x41); emit8(jit, 0x56);                    // push r14
+    emit8(jit, 0x41); emit8(jit, 0x57);                    // push r15
+    emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xec); emit8(jit, 0x08);  // sub rsp, 8
+    emit8(jit, 0x48); emit8(jit, 0x89); emit8(jit, 0xfd);  // mov rbp, rdi
+    emit8(jit, 0x49); emit8(jit, 0x89); emit8(jit, 0xd4);  // mov r12, rdx
+    emit_rbp(jit, "\x4c\x8b", 2, 5, CPU(mem));             // mov r13, [rbp + mem]
+    emit8(jit, 0x4d); emit8(jit, 0x8d); emit8(jit, 0x6d);  // lea r13, [r13 + read_page]
+    emit8(jit, offsetof(mem_t, read_page));
+    emit8(jit, 0x49); emit8(jit, 0xbe);                    // mov r14, &invalidated
+    emit64(jit, (uint64_t) (uintptr_t) &jit->invalidated);
+    emit8(jit, 0x49); emit8(jit, 0xbf);                    // mov r15, blocks
+    emit64(jit, (uint64_t) (uintptr_t) jit->blocks);
+    emit8(jit, 0x49); emit8(jit, 0x89); emit8(jit, 0xf0);  // mov r8, rsi
+    emit_reload(jit);
+    emit8(jit, 0x41); emit8(jit, 0xff); emit8(jit, 0xe0);  // jmp r8
+
+    // Back to C, returning the cycles left
+    jit->exit = jit->ptr;
+    emit_spill(jit);
+    emit8(jit, 0x4c); emit8(jit, 0x89); emit8(jit, 0xe0);  // mov rax, r12
+    emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xc4); emit8(jit, 0x08);  // add rsp, 8
+    emit8(jit, 0x41); emit8(jit, 0x5f);                    // pop r15
+    emit8(jit, 0x41); emit8(jit, 0x5e);                    // pop r14
+    emit8(jit, 0x41); emit8(jit, 0x5d);                    // pop r13
+    emit8(jit, 0x41); emit8(jit, 0x5c);                    // pop r12
+    emit8(jit, 0x5d);                                      // pop rbp
+    emit8(jit, 0x5b);                                      // pop rbx
+    emit8(jit, 0xc3);                                      // ret
+
+    // Chain to the block at di, if it is translated
+    jit->dispatch = jit->ptr;
+    emit_dispatch(jit);
+
+    // Called from out of line code with the registers spilled and the
+    // arguments of mem_write_slow() set
+    jit->write_slow = jit->ptr;
+    emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xec); emit8(jit, 0x08);  // sub rsp, 8
+    emit8(jit, 0x48); emit8(jit, 0xb8);                    // mov rax, mem_write_slow
+    emit64(jit, (uint64_t) (uintptr_t) mem_write_slow);
+    emit8(jit, 0xff); emit8(jit, 0xd0);                    // call rax
+    emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xc4); emit8(jit, 0x08);  // add rsp, 8
+    emit8(jit, 0xc3);                                      // ret
+
+    jit->start = jit->ptr;
+}
+
+static void jit_flush(jit_t *jit) {
+    memset(jit->blocks, 0, sizeof jit->blocks);
+    memset(jit->link_head, 0xff, sizeof jit->link_head);
+    jit->link_count = 0;
+    mem_clear_watch(jit->cpu->mem);
+    jit->ptr = jit->start;
+    jit->invalidated = 0;
+}
+
+// Called by mem_write() after a write to translated code
+static void jit_code_write(void *ctx, uint16_t addr) {
+    jit_t *jit = ctx;
+
+    memset(jit->blocks, 0, sizeof jit->blocks);
+    jit->invalidated = 1;
+}
+
+static uint8_t *jit_compile(jit_t *jit, uint16_t start) {
+    mem_t *mem = jit->cpu->mem;
+
+    if (jit->code + CODE_SIZE - jit->ptr < BLOCK_SLACK) {
+        jit_flush(jit);
+    }
+
+    // Loads only skip the handlers while no page has a read handler
+    jit->native_loads = 1;
+    for (int p = 0; p < MEM_PAGES; p++) {
+        if (!mem->read_page[p]) {
+            jit->native_loads = 0;
+        }
+    }
+
+    jit->ir = jit->z = jit->w = -1;
+
+    // Leave with pc at the block unless the budget covers its worst case,
+    // patched in once that is known
+    uint8_t *block = jit->ptr;
+    emit8(jit, 0x49); emit8(jit, 0x81); emit8(jit, 0xfc); emit32(jit, 0);  // cmp r12, imm32
+    uint8_t *worst = jit->ptr - 4;
+    emit_cold(jit, CC_L, COLD_EXIT, start);
+
+    uint16_t pc = start;
+    int ended = 0;
+    int cycles = 0;
+
+    for (int n = 0; n < MAX_BLOCK && !ended; n++) {
+        uint8_t code[3] = { mem_read(mem, pc), mem_read(mem, pc + 1), mem_read(mem, pc + 2) };
+        uint8_t op = code[0];
+        int length = cpu_length(op);
+        if (pc + length > JIT_END) {
+            break;
+        }
+
+        // Leave unimplemented instructions to the interpreter to report
+        cpu_handler_t handler = cpu_handler(op);
+        if (!handler) {
+            break;
+        }
+
+        jit->instructions++;
+        cycles += disasm_ops[op].cycles_taken;
+        jit->ir = op;
+        if (length > 1) {
+            jit->z = code[1];
+        }
+        if (length > 2) {
+            jit->w = code[2];
+        }
+        if (!emit_native(jit, code, pc)) {
+            emit_call(jit, code, pc, handler);
+            if (op_ends_block(op)) {
+                emit_rbp(jit, "\x0f\xb7", 2, EDI, CPU(pc));  // movzx edi, word [rbp + pc]
+                emit_exit_dynamic(jit);
+            }
+        }
+
+        for (int i = 0; i < length; i++) {
+            mem_watch(mem, pc + i);
+        }
+        ended = op_ends_block(op);
+        pc += length;
+    }
+
+    if (pc == start) {
+        jit->ptr = block;
+        jit->cold_count = 0;
+        return NULL;  // Nothing could be translated
+    }
+    memcpy(worst, &cycles, 4);
+
+    if (!ended) {
+        emit_exit(jit, pc);
+    }
+    emit_cold_code(jit);
+
+    // Exits already waiting for this block now jump straight to it
+    jit->blocks[start] = block;
+    jit->block_cycles[start] = cycles;
+    for (int i = jit->link_head[start]; i >= 0; i = jit->links[i].next) {
+        int32_t rel = block - (jit->links[i].jump + 4);
+        memcpy(jit->links[i].jump, &rel, 4);
+    }
+    jit->link_head[start] = -1;
+
+    return block;
+}
+
+
+jit_t *jit_new(struct cpu *cpu) {
+    // The flags go through LAHF and SAHF, which the first x86-64 CPUs lack
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(ecx & 1)) {
+        return NULL;
+    }
+
+    uint8_t *code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+
+    jit_t *jit = calloc(1, sizeof(jit_t));
+    jit->cpu = cpu;
+    jit->code = code;
+    jit_emit_stubs(jit);
+    mem_set_watch(cpu->mem, jit_code_write, jit);
+    jit_flush(jit);
+
+    return jit;
+}
+
+
+void jit_free(jit_t *jit) {
+    mem_set_watch(jit->cpu->mem, NULL, NULL);
+    munmap(jit->code, CODE_SIZE);
+    free(jit);
+}
+
+
+// Same contract as cpu_run()
+long jit_run(jit_t *jit, long cycles) {
+    struct cpu *cpu = jit->cpu;
+    long left = cycles;
+
+    while (left > 0) {
+        if (jit->invalidated) {
+            jit_flush(jit);
+        }
+
+        // Near the deadline only blocks already translated are tried, as one
+        // at each instruction the last ones do not fit in would fill the cache
+        if (cpu->pc < JIT_END) {
+            uint8_t *block = jit->blocks[cpu->pc];
+            if (!block && left >= JIT_MAX_CYCLES) {
+                block = jit_compile(jit, cpu->pc);
+            }
+            if (block && left >= jit->block_cycles[cpu->pc]) {
+                left = jit->enter(cpu, block, left);
+                continue;
+            }
+        }
+
+        // Not translatable or over budget, interpret one instruction
+        cpu_fetch(cpu);
+        int c = cpu_run_instruction(cpu);
+        if (!c) {
+            return -1;
+        }
+        left -= c;
+    }
+
+    return cycles - left;
+}
+
+#else
+
+jit_t *jit_new(struct cpu *cpu) {
+    return NULL;  // Only x86-64 is supported, callers fall back to cpu_run()
+}
+
+void jit_free(jit_t *jit) {
+}
+
+long jit_run(jit_t *jit, long cycles) {
+    return -1;
+}
+
+#endif
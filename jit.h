@@ -0,0 +1,15 @@
+#ifndef _H_JIT_
+#define _H_JIT_
+
+#include "cpu.h"
+
+#define JIT_END 0x2000  // Only code below this address (the ROM) is translated
+#define JIT_MAX_CYCLES (64 * 18)  // Most a block can take: 64 instructions, XTHL the slowest
+
+typedef struct jit jit_t;
+
+jit_t *jit_new(struct cpu *cpu);
+void jit_free(jit_t *jit);
+long jit_run(jit_t *jit, long cycles);
+
+#endif
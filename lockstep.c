@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lockstep.h"
+#include "disassembler.h"
+
+/*
+ * Lockstep
+ *
+ * Checks an execution engine against the interpreter. The machine under test
+ * runs one step at a time: one instruction on the interpreter or the uop
+ * cache, the cycles of the longest block on the JIT, as it only runs a block
+ * the budget covers. A reference machine on the interpreter then takes the
+ * same events and runs the same number of instructions, one by one, and the
+ * two are compared: registers, master cycle counter and RAM. The first
+ * difference stops the run.
+ *
+ * Only the reference logs its writes, for the dump: logging makes every write
+ * take the slow path, and the fast paths of the machine under test, inline
+ * stores of the JIT included, are what is being checked.
+ */
+
+#define LOG_SIZE 1024  // Writes logged per step
+#define HISTORY 16     // Reference instructions kept for the dump
+#define MAX_DIFFS 16   // Differing RAM bytes printed by the dump
+
+struct lockstep {
+    emu_t *ref;
+    emu_t *test;
+
+    mem_log_entry_t ref_log[LOG_SIZE];
+
+    // PCs of the last instructions the reference ran
+    uint16_t history[HISTORY];
+    uint64_t executed;
+
+    uint16_t step_pc;    // Test PC at the start of the last step
+    const char *reason;  // What differed, NULL while they agree
+};
+
+
+// Check test against ref, which must be a machine on the interpreter running
+// the same ROM. The state of test is copied into ref. Returns NULL if they
+// are not the same kind of machine.
+lockstep_t *lockstep_new(emu_t *ref, emu_t *test) {
+    void *state = malloc(emu_state_size(test));
+    emu_save(test, state);
+    int restored = emu_restore(ref, state);
+    free(state);
+    if (restored < 0) {
+        return NULL;
+    }
+
+    lockstep_t *ls = calloc(1, sizeof(lockstep_t));
+    ls->ref = ref;
+    ls->test = test;
+    mem_set_log(ref->cpu.mem, ls->ref_log, LOG_SIZE);
+
+    return ls;
+}
+
+
+void lockstep_free(lockstep_t *ls) {
+    mem_set_log(ls->ref->cpu.mem, NULL, 0);
+    free(ls);
+}
+
+
+// Run the reference up to the instruction count of the machine under test,
+// without taking events in between. Returns -1 on an unimplemented
+// instruction.
+static int catch_up(lockstep_t *ls) {
+    emu_t *ref = ls->ref;
+
+    while (ref->cpu.instructions < ls->test->cpu.instructions) {
+        ls->history[ls->executed++ % HISTORY] = ref->cpu.pc;
+
+        cpu_fetch(&ref->cpu);
+        int c = cpu_run_instruction(&ref->cpu);
+        if (!c) {
+            return -1;
+        }
+        ref->sched.now += c;
+    }
+
+    return 0;
+}
+
+// What differs after a step, or NULL
+static const char *compare(const lockstep_t *ls, int ref_result, int test_result) {
+    const struct cpu *r = &ls->ref->cpu;
+    const struct cpu *t = &ls->test->cpu;
+
+    if (ref_result != test_result) {
+        return "end of frame";
+    }
+    if (r->instructions != t->instructions) {
+        return "instruction count";
+    }
+    if (r->pc != t->pc || r->sp != t->sp || r->bc != t->bc || r->de != t->de ||
+            r->hl != t->hl || r->a != t->a || r->f != t->f ||
+            r->inte != t->inte || r->halted != t->halted) {
+        return "registers";
+    }
+    if (ls->ref->sched.now != ls->test->sched.now) {
+        return "cycles";
+    }
+
+    const mem_t *rm = r->mem;
+    const mem_t *tm = t->mem;
+    for (int i = 0; i < tm->ram_run_count; i++) {
+        uint32_t offset = tm->ram_runs[i].offset;
+        if (memcmp(rm->mem + offset, tm->mem + offset, tm->ram_runs[i].size)) {
+            return "RAM";
+        }
+    }
+
+    return NULL;
+}
+
+
+// Run a frame on both machines, the reference getting the inputs of the one
+// under test. Returns -1 when they diverge or either hits an unimplemented
+// instruction, see lockstep_dump(), 0 otherwise.
+int lockstep_run_frame(lockstep_t *ls) {
+    emu_t *ref = ls->ref;
+    emu_t *test = ls->test;
+
+    ref->ports[1] = test->ports[1];
+    ref->ports[2] = test->ports[2];
+
+    for (;;) {
+        ls->step_pc = test->cpu.pc;
+        ref->cpu.mem->log_count = 0;
+
+        // Same events on both, then the reference follows the test step
+        int test_result = emu_step(test, test->jit ? JIT_MAX_CYCLES : 1);
+        int ref_result = emu_step(ref, 0);
+        if (test_result < 0 || ref_result < 0 || catch_up(ls) < 0) {
+            ls->reason = "unimplemented instruction";
+            return -1;
+        }
+
+        ls->reason = compare(ls, ref_result, test_result);
+        if (ls->reason) {
+            return -1;
+        }
+        if (test_result) {
+            return 0;
+        }
+    }
+}
+
+
+static void dump_cpu(const char *name, const emu_t *emu) {
+    const struct cpu *cpu = &emu->cpu;
+
+    printf("%-9s PC: %04x  SP: %04x  BC: %04x  DE: %04x  HL: %04x  A: %02x  F: %02x  "
+           "INTE: %d  HLT: %d  instructions: %llu  cycle: %llu\n", name,
+            cpu->pc, cpu->sp, cpu->bc, cpu->de, cpu->hl, cpu->a, cpu->f,
+            cpu->inte, cpu->halted, (unsigned long long) cpu->instructions,
+            (unsigned long long) emu->sched.now);
+}
+
+// Print where and how the machines diverged: the instructions leading to it,
+// both register files, the writes of the reference in the last step and the
+// RAM that differs
+void lockstep_dump(const lockstep_t *ls) {
+    printf("Diverged (%s) in the step from %04x, frame %llu\n", ls->reason,
+            ls->step_pc, (unsigned long long) ls->test->frame);
+
+    puts("Last instructions run:");
+    uint64_t first = ls->executed > HISTORY ? ls->executed - HISTORY : 0;
+    for (uint64_t i = first; i < ls->executed; i++) {
+        uint16_t pc = ls->history[i % HISTORY];
+        uint8_t code[3];
+        for (int j = 0; j < 3; j++) {
+            code[j] = mem_read(ls->ref->cpu.mem, pc + j);
+        }
+        printf("  %04x  ", pc);
+        disassemble(code);
+        puts("");
+    }
+
+    dump_cpu("Reference", ls->ref);
+    dump_cpu("Test", ls->test);
+
+    const mem_t *rm = ls->ref->cpu.mem;
+    const mem_t *tm = ls->test->cpu.mem;
+    printf("Reference writes in the step: %d\n", rm->log_count);
+    for (int i = 0; i < rm->log_count && i < LOG_SIZE; i++) {
+        printf("  %04x <- %02x\n", rm->log[i].addr, rm->log[i].value);
+    }
+
+    puts("RAM that differs (backing offset: reference, test):");
+    int diffs = 0;
+    for (int i = 0; i < tm->ram_run_count; i++) {
+        uint32_t offset = tm->ram_runs[i].offset;
+        for (uint32_t a = offset; a < offset + tm->ram_runs[i].size && diffs < MAX_DIFFS; a++) {
+            if (rm->mem[a] != tm->mem[a]) {
+                printf("  %04x: %02x, %02x\n", a, rm->mem[a], tm->mem[a]);
+                diffs++;
+            }
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef _H_LOCKSTEP_
+#define _H_LOCKSTEP_
+
+#include "emu.h"
+
+typedef struct lockstep lockstep_t;
+
+lockstep_t *lockstep_new(emu_t *ref, emu_t *test);
+void lockstep_free(lockstep_t *ls);
+int lockstep_run_frame(lockstep_t *ls);
+void lockstep_dump(const lockstep_t *ls);
+
+#endif
@@ -7,15 +7,82 @@
 #include "mem.h"
 
 
+// Backing page of a CPU page
+static int mem_backing_page(const mem_t *mem, int p) {
+    return (mem->page[p] - mem->mem) / MEM_PAGE_SIZE;
+}
+
+
+// Recompute the fast path pointers of a page
+static void mem_update_page(mem_t *mem, int p) {
+    mem->read_page[p] = mem->read_handler[p] ? NULL : mem->page[p];
+
+    int fast = mem->writable[p] && !mem->write_handler[p] &&
+               !mem->watched[mem_backing_page(mem, p)] && !mem->log;
+    mem->write_page[p] = fast ? mem->page[p] : NULL;
+}
+
+
+// Recompute whether mem_restore() checks a backing page for changed code
+static void mem_update_restore(mem_t *mem, int bp) {
+    uint64_t bit = (uint64_t) 1 << bp % 64;
+    if (mem->watched[bp] && mem->ram_slot[bp] >= 0) {
+        mem->restore_pages[bp / 64] |= bit;
+    } else {
+        mem->restore_pages[bp / 64] &= ~bit;
+    }
+}
+
+
+// Recompute which backing pages snapshots hold
+static void mem_update_slots(mem_t *mem) {
+    uint8_t ram[MEM_PAGES] = {0};
+    for (int p = 0; p < MEM_PAGES; p++) {
+        if (mem->page[p] && mem->writable[p]) {
+            ram[(mem->page[p] - mem->mem) / MEM_PAGE_SIZE] = 1;
+        }
+    }
+
+    mem->ram_pages = 0;
+    mem->ram_run_count = 0;
+    for (int bp = 0; bp < mem->size / MEM_PAGE_SIZE; bp++) {
+        mem->ram_slot[bp] = ram[bp] ? mem->ram_pages++ : -1;
+        mem_update_restore(mem, bp);
+
+        if (ram[bp] && bp > 0 && ram[bp - 1]) {
+            mem->ram_runs[mem->ram_run_count - 1].size += MEM_PAGE_SIZE;
+        } else if (ram[bp]) {
+            mem->ram_runs[mem->ram_run_count].offset = bp * MEM_PAGE_SIZE;
+            mem->ram_runs[mem->ram_run_count].size = MEM_PAGE_SIZE;
+            mem->ram_run_count++;
+        }
+    }
+}
+
+
+// New memory of size bytes, mapped as RAM from address 0 and repeated over
+// the rest of the address space
 mem_t *mem_new(int size) {
-    mem_t *mem = malloc(sizeof(mem_t));
+    assert(size > 0 && size % MEM_PAGE_SIZE == 0 && size <= 0x10000);
+
+    mem_t *mem = calloc(1, sizeof(mem_t));
     mem->size = size;
 
     mem->mem = malloc(sizeof(uint8_t) * size);
 
+    for (uint32_t addr = 0; addr < 0x10000; addr += size) {
+        mem_map(mem, addr, addr + size, 0, MEM_RAM);
+    }
+
     return mem;
 }
 
+void mem_free(mem_t *mem) {
+    free(mem->code);
+    free(mem->mem);
+    free(mem);
+}
+
 void mem_load(mem_t *mem, int offset, const uint8_t *data, size_t size) {
     memcpy(mem->mem + offset, data, size);
 }
@@ -26,14 +93,187 @@ void mem_reset(mem_t *mem) {
 }
 
 
-void mem_write(mem_t *mem, uint16_t addr, uint8_t value) {
-    assert(addr >= 0 && addr < mem->size);
-    mem->mem[addr] = value;
+// Map addresses [start, end) onto the backing store from target on, as ROM
+// (writes are ignored) or RAM. Bounds must be multiples of the page size.
+void mem_map(mem_t *mem, uint32_t start, uint32_t end, uint32_t target, int flags) {
+    assert(start % MEM_PAGE_SIZE == 0 && end % MEM_PAGE_SIZE == 0);
+    assert(end <= 0x10000 && target + (end - start) <= mem->size);
+
+    for (uint32_t addr = start; addr < end; addr += MEM_PAGE_SIZE) {
+        int p = addr >> MEM_PAGE_BITS;
+        mem->page[p] = mem->mem + target + (addr - start);
+        mem->writable[p] = flags == MEM_RAM;
+        mem->read_handler[p] = NULL;
+        mem->write_handler[p] = NULL;
+        mem_update_page(mem, p);
+    }
+
+    mem_update_slots(mem);
+}
+
+
+// Send accesses to [start, end) to handlers instead. Either may be NULL to
+// keep the mapped backing for that direction.
+void mem_set_handlers(mem_t *mem, uint32_t start, uint32_t end, mem_read_t read, mem_write_t write) {
+    assert(start % MEM_PAGE_SIZE == 0 && end % MEM_PAGE_SIZE == 0 && end <= 0x10000);
+
+    for (uint32_t addr = start; addr < end; addr += MEM_PAGE_SIZE) {
+        int p = addr >> MEM_PAGE_BITS;
+        mem->read_handler[p] = read;
+        mem->write_handler[p] = write;
+        mem_update_page(mem, p);
+    }
+}
+
+
+void mem_set_watch(mem_t *mem, void (*code_write)(void *ctx, uint16_t addr), void *ctx) {
+    mem_clear_watch(mem);
+    mem->code_write = code_write;
+    mem->code_ctx = ctx;
 }
 
 
-uint8_t mem_read(mem_t *mem, uint16_t addr) {
-    return mem->mem[addr];
+// Call code_write() after any write to the byte of the backing store at
+// addr, through addr or any other address mapped to it. Writes to the rest
+// of its page leave the fast path too, so keep watches to code.
+void mem_watch(mem_t *mem, uint16_t addr) {
+    if (!mem->code) {
+        mem->code = calloc(mem->size, 1);
+    }
+
+    int p = addr >> MEM_PAGE_BITS;
+    int offset = mem->page[p] - mem->mem + (addr & (MEM_PAGE_SIZE - 1));
+    mem->code[offset] = 1;
+
+    int bp = offset / MEM_PAGE_SIZE;
+    if (!mem->watched[bp]) {
+        mem->watched[bp] = 1;
+        for (int q = 0; q < MEM_PAGES; q++) {
+            if (mem_backing_page(mem, q) == bp) {
+                mem_update_page(mem, q);
+            }
+        }
+        mem_update_restore(mem, bp);
+    }
+}
+
+
+void mem_clear_watch(mem_t *mem) {
+    if (mem->code) {
+        memset(mem->code, 0, mem->size);
+    }
+
+    memset(mem->watched, 0, sizeof mem->watched);
+    memset(mem->restore_pages, 0, sizeof mem->restore_pages);
+    for (int p = 0; p < MEM_PAGES; p++) {
+        mem_update_page(mem, p);
+    }
+}
+
+
+// Report a write to the watched byte at offset in the backing store, once
+// for every address it is mapped at
+static void mem_code_write(mem_t *mem, int offset) {
+    const uint8_t *page = mem->mem + offset / MEM_PAGE_SIZE * MEM_PAGE_SIZE;
+
+    for (int p = 0; p < MEM_PAGES; p++) {
+        if (mem->page[p] == page) {
+            mem->code_write(mem->code_ctx, p * MEM_PAGE_SIZE + offset % MEM_PAGE_SIZE);
+        }
+    }
+}
+
+
+// Log every write into log, which has room for size entries, or stop logging
+// if it is NULL
+void mem_set_log(mem_t *mem, mem_log_entry_t *log, int size) {
+    mem->log = log;
+    mem->log_size = log ? size : 0;
+    mem->log_count = 0;
+
+    for (int p = 0; p < MEM_PAGES; p++) {
+        mem_update_page(mem, p);
+    }
+}
+
+
+// Bytes mem_save() writes
+size_t mem_state_size(const mem_t *mem) {
+    return (size_t) mem->ram_pages * MEM_PAGE_SIZE;
+}
+
+
+// Copy the RAM out, one run of RAM pages after another
+void mem_save(const mem_t *mem, uint8_t *buf) {
+    for (int i = 0; i < mem->ram_run_count; i++) {
+        memcpy(buf, mem->mem + mem->ram_runs[i].offset, mem->ram_runs[i].size);
+        buf += mem->ram_runs[i].size;
+    }
+}
+
+
+// Report changed watched code before a backing page is restored from buf
+static void mem_restore_page(mem_t *mem, int bp, const uint8_t *buf) {
+    const uint8_t *saved = buf + mem->ram_slot[bp] * MEM_PAGE_SIZE;
+
+    for (int i = 0; i < MEM_PAGE_SIZE; i++) {
+        int offset = bp * MEM_PAGE_SIZE + i;
+        if (mem->code[offset] && mem->mem[offset] != saved[i]) {
+            mem_code_write(mem, offset);
+        }
+    }
+}
+
+
+// Copy the RAM back from mem_save(). Watched code that changes is reported
+// to code_write() as if written by the CPU.
+void mem_restore(mem_t *mem, const uint8_t *buf) {
+    for (int w = 0; w < MEM_PAGES / 64; w++) {
+        for (uint64_t bits = mem->restore_pages[w]; bits; bits &= bits - 1) {
+            mem_restore_page(mem, w * 64 + __builtin_ctzll(bits), buf);
+        }
+    }
+
+    for (int i = 0; i < mem->ram_run_count; i++) {
+        memcpy(mem->mem + mem->ram_runs[i].offset, buf, mem->ram_runs[i].size);
+        buf += mem->ram_runs[i].size;
+    }
+}
+
+
+uint8_t mem_read_slow(mem_t *mem, uint16_t addr) {
+    int p = addr >> MEM_PAGE_BITS;
+
+    if (mem->read_handler[p]) {
+        return mem->read_handler[p](mem, addr);
+    }
+
+    return mem->page[p][addr & (MEM_PAGE_SIZE - 1)];
+}
+
+
+void mem_write_slow(mem_t *mem, uint16_t addr, uint8_t value) {
+    int p = addr >> MEM_PAGE_BITS;
+
+    if (mem->log) {
+        if (mem->log_count < mem->log_size) {
+            mem->log[mem->log_count] = (mem_log_entry_t) { addr, value };
+        }
+        mem->log_count++;
+    }
+
+    if (mem->write_handler[p]) {
+        mem->write_handler[p](mem, addr, value);
+    } else if (mem->writable[p]) {
+        mem->page[p][addr & (MEM_PAGE_SIZE - 1)] = value;
+    } else {
+        return;  // ROM, nothing changed
+    }
+
+    int offset = mem->page[p] - mem->mem + (addr & (MEM_PAGE_SIZE - 1));
+    if (mem->code && mem->code[offset]) {
+        mem_code_write(mem, offset);
+    }
 }
 
 
@@ -4,16 +4,106 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#define MEM_PAGE_BITS 8
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_PAGES (0x10000 >> MEM_PAGE_BITS)
+
+#define MEM_ROM 0  // mem_map() flags
+#define MEM_RAM 1
+
+typedef struct mem mem_t;
+
+typedef uint8_t (*mem_read_t)(mem_t *mem, uint16_t addr);
+typedef void (*mem_write_t)(mem_t *mem, uint16_t addr, uint8_t value);
+
+// A write recorded by the write log, see mem_set_log()
 typedef struct {
+    uint16_t addr;
+    uint8_t value;
+} mem_log_entry_t;
+
+// The 64 KB address space is split in 256-byte pages, each one backed by a
+// page of the backing store (ROM or RAM) or by read/write handlers. Plain
+// reads and writes go straight through a host pointer; anything else (ROM
+// writes, handlers, watched code) takes the slow path in mem.c.
+struct mem {
     int size;
-    uint8_t *mem;
-} mem_t;
+    uint8_t *mem;  // Backing store
+
+    // Fast path: base of each page, NULL to take the slow path
+    uint8_t *read_page[MEM_PAGES];
+    uint8_t *write_page[MEM_PAGES];
+
+    // Slow path
+    uint8_t *page[MEM_PAGES];  // Backing of each page
+    uint8_t writable[MEM_PAGES];
+    mem_read_t read_handler[MEM_PAGES];
+    mem_write_t write_handler[MEM_PAGES];
+
+    // Optional write watch for execution engines that cache translated code:
+    // code_write() is called after a write to any byte of the backing store
+    // an address passed to mem_watch() maps to, once for every address that
+    // maps it, so writes through mirrors are caught. Both are by backing
+    // store offset, and by backing page. Writes dropped by ROM are not
+    // reported.
+    uint8_t *code;
+    uint8_t watched[MEM_PAGES];
+    void (*code_write)(void *ctx, uint16_t addr);
+    void *code_ctx;
+
+    // Snapshots only hold the backing pages mapped as RAM, in order. Slot of
+    // each backing page in a snapshot, -1 for ROM, and the runs of RAM.
+    int16_t ram_slot[MEM_PAGES];
+    int ram_pages;
+    struct { uint32_t offset, size; } ram_runs[MEM_PAGES];
+    int ram_run_count;
+
+    // Optional log of every write, ROM included, in order. While it is set
+    // all writes take the slow path. The consumer resets log_count, which
+    // keeps counting past log_size when the log is full.
+    mem_log_entry_t *log;
+    int log_size;
+    int log_count;
+
+    // Backing pages of RAM that are watched, one bit each
+    uint64_t restore_pages[MEM_PAGES / 64];
+};
 
 mem_t *mem_new(int size);
+void mem_free(mem_t *mem);
 void mem_reset(mem_t *mem);
 void mem_load(mem_t *mem, int offset, const uint8_t *data, size_t size);
-void mem_write(mem_t *mem, uint16_t addr, uint8_t value);
-uint8_t mem_read(mem_t *mem, uint16_t addr);
+void mem_map(mem_t *mem, uint32_t start, uint32_t end, uint32_t target, int flags);
+void mem_set_handlers(mem_t *mem, uint32_t start, uint32_t end, mem_read_t read, mem_write_t write);
+void mem_set_watch(mem_t *mem, void (*code_write)(void *ctx, uint16_t addr), void *ctx);
+void mem_watch(mem_t *mem, uint16_t addr);
+void mem_clear_watch(mem_t *mem);
+void mem_set_log(mem_t *mem, mem_log_entry_t *log, int size);
+size_t mem_state_size(const mem_t *mem);
+void mem_save(const mem_t *mem, uint8_t *buf);
+void mem_restore(mem_t *mem, const uint8_t *buf);
+uint8_t mem_read_slow(mem_t *mem, uint16_t addr);
+void mem_write_slow(mem_t *mem, uint16_t addr, uint8_t value);
 void mem_dump(mem_t *mem);
 
+
+static inline uint8_t mem_read(mem_t *mem, uint16_t addr) {
+    const uint8_t *page = mem->read_page[addr >> MEM_PAGE_BITS];
+    if (page) {
+        return page[addr & (MEM_PAGE_SIZE - 1)];
+    }
+
+    return mem_read_slow(mem, addr);
+}
+
+static inline void mem_write(mem_t *mem, uint16_t addr, uint8_t value) {
+    uint8_t *page = mem->write_page[addr >> MEM_PAGE_BITS];
+    if (page) {
+        page[addr & (MEM_PAGE_SIZE - 1)] = value;
+        return;
+    }
+
+    mem_write_slow(mem, addr, value);
+}
+
 #endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+
+/*
+ * File format
+ *
+ *   "INVMOVIE"  magic
+ *   uint32      frames
+ *   records of uint16 run, uint8 port 1, uint8 port 2
+ *
+ * Integers are little endian. Each record holds the inputs of the next run
+ * frames, so a minute of play takes a few hundred bytes.
+ */
+
+#define MAGIC "INVMOVIE"
+#define MAX_RUN 0xffff
+
+
+movie_t *movie_new() {
+    return calloc(1, sizeof(movie_t));
+}
+
+
+void movie_free(movie_t *movie) {
+    free(movie->frames);
+    free(movie);
+}
+
+
+// Set the inputs of a frame, dropping any frames recorded after it (there
+// are some after a rewind)
+void movie_record(movie_t *movie, long frame, uint8_t port1, uint8_t port2) {
+    if (frame >= movie->capacity) {
+        movie->capacity = frame + 1 > 2 * movie->capacity ? frame + 1 : 2 * movie->capacity;
+        movie->frames = realloc(movie->frames, movie->capacity * sizeof movie->frames[0]);
+    }
+
+    // Frames skipped over keep the previous inputs
+    for (long i = movie->count; i < frame; i++) {
+        movie->frames[i][0] = i ? movie->frames[i - 1][0] : 0;
+        movie->frames[i][1] = i ? movie->frames[i - 1][1] : 0;
+    }
+
+    movie->frames[frame][0] = port1;
+    movie->frames[frame][1] = port2;
+    movie->count = frame + 1;
+}
+
+
+// Inputs of a frame. Returns 0 past the end of the movie.
+int movie_input(const movie_t *movie, long frame, uint8_t *port1, uint8_t *port2) {
+    if (frame < 0 || frame >= movie->count) {
+        return 0;
+    }
+
+    *port1 = movie->frames[frame][0];
+    *port2 = movie->frames[frame][1];
+    return 1;
+}
+
+
+// Returns -1 if the file could not be written
+int movie_save(const movie_t *movie, const char *file_name) {
+    FILE *f = fopen(file_name, "wb");
+    if (!f) {
+        return -1;
+    }
+
+    uint8_t header[12];
+    memcpy(header, MAGIC, 8);
+    for (int i = 0; i < 4; i++) {
+        header[8 + i] = movie->count >> (8 * i);
+    }
+    fwrite(header, sizeof header, 1, f);
+
+    for (long i = 0; i < movie->count; ) {
+        long run = 1;
+        while (i + run < movie->count && run < MAX_RUN &&
+                !memcmp(movie->frames[i + run], movie->frames[i], 2)) {
+            run++;
+        }
+
+        uint8_t record[4] = { run, run >> 8, movie->frames[i][0], movie->frames[i][1] };
+        fwrite(record, sizeof record, 1, f);
+        i += run;
+    }
+
+    return fclose(f) ? -1 : 0;
+}
+
+
+// Returns NULL if the file is missing or not a movie
+movie_t *movie_load(const char *file_name) {
+    FILE *f = fopen(file_name, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    uint8_t header[12];
+    if (fread(header, sizeof header, 1, f) != 1 || memcmp(header, MAGIC, 8)) {
+        fclose(f);
+        return NULL;
+    }
+
+    long count = header[8] | header[9] << 8 | header[10] << 16 | (long) header[11] << 24;
+
+    movie_t *movie = movie_new();
+    uint8_t record[4];
+    while (movie->count < count && fread(record, sizeof record, 1, f) == 1) {
+        long run = record[0] | record[1] << 8;
+        for (long i = 0; i < run && movie->count < count; i++) {
+            movie_record(movie, movie->count, record[2], record[3]);
+        }
+    }
+
+    fclose(f);
+
+    if (movie->count != count) {
+        movie_free(movie);
+        return NULL;
+    }
+    return movie;
+}
@@ -0,0 +1,21 @@
+#ifndef _H_MOVIE_
+#define _H_MOVIE_
+
+#include <stdint.h>
+
+// Inputs of a run, frame by frame: what ports 1 and 2 held at the start of
+// each frame. Replaying them on the same ROM gives the same run, bit by bit.
+typedef struct {
+    uint8_t (*frames)[2];
+    long count;
+    long capacity;
+} movie_t;
+
+movie_t *movie_new();
+void movie_free(movie_t *movie);
+void movie_record(movie_t *movie, long frame, uint8_t port1, uint8_t port2);
+int movie_input(const movie_t *movie, long frame, uint8_t *port1, uint8_t *port2);
+int movie_save(const movie_t *movie, const char *file_name);
+movie_t *movie_load(const char *file_name);
+
+#endif
@@ -0,0 +1,119 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "pace.h"
+
+/*
+ * Pacing
+ *
+ * Frame n is due exactly n / rate seconds after the start, so deadlines never
+ * drift however long the run, and the thread sleeps until each one with an
+ * absolute clock_nanosleep(). A frame that starts late does not push the
+ * following ones back. Only after falling more than MAX_BEHIND frames behind
+ * (a stall, a debugger) does the clock restart from the current time,
+ * instead of running the missed frames back to back.
+ */
+
+#define MAX_BEHIND 3  // Frames
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t deadline(const pace_t *pace, uint64_t frame) {
+    return pace->start + frame * 1000000000 / pace->rate;
+}
+
+
+// Start pacing at rate frames per second, from now
+void pace_init(pace_t *pace, long rate) {
+    memset(pace, 0, sizeof *pace);
+    pace->rate = rate;
+    pace->start = now_ns();
+}
+
+
+// Change the rate, the next frame being due a period from now
+void pace_set_rate(pace_t *pace, long rate) {
+    pace->rate = rate;
+    pace->start = now_ns();
+    pace->frame = 0;
+}
+
+
+// Sleep until the next frame is due. Returns 1 if it was already due, that
+// is, the frame just run took too long.
+int pace_wait(pace_t *pace) {
+    uint64_t due = deadline(pace, ++pace->frame);
+    uint64_t now = now_ns();
+
+    if (now >= due) {
+        pace->missed++;
+        if (now - due > MAX_BEHIND * 1000000000ull / pace->rate) {
+            pace->start = now;
+            pace->frame = 0;
+            pace->resyncs++;
+        }
+        return 1;
+    }
+
+    // Go back to sleep when interrupted by a signal. Any other error means
+    // no absolute sleeps here, so sleep for the time left instead.
+    struct timespec ts = { due / 1000000000, due % 1000000000 };
+    int err;
+    while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR) {
+    }
+    if (err) {
+        uint64_t left = due - now;
+        struct timespec rel = { left / 1000000000, left % 1000000000 };
+        while (nanosleep(&rel, &rel) && errno == EINTR) {
+        }
+    }
+
+    now = now_ns();
+    uint64_t late = now > due ? now - due : 0;
+    uint64_t us = late / 1000;
+    pace->waits++;
+    pace->late_total += late;
+    if (late > pace->late_max) {
+        pace->late_max = late;
+    }
+    pace->late[us < PACE_BUCKETS ? us : PACE_BUCKETS]++;
+
+    return 0;
+}
+
+
+// Lateness of wakeups after the fraction p of them
+static double percentile(const pace_t *pace, double p) {
+    uint64_t seen = 0;
+    for (int us = 0; us <= PACE_BUCKETS; us++) {
+        seen += pace->late[us];
+        if (seen > p * pace->waits) {
+            return us;
+        }
+    }
+
+    return PACE_BUCKETS;
+}
+
+// Print how the pacing went: wakeup jitter and missed deadlines
+void pace_report(const pace_t *pace, FILE *f) {
+    if (!pace->waits) {
+        return;
+    }
+
+    fprintf(f, "Pacing: %llu frames, wakeups late by %.1f us on average, "
+               "p50 %.0f us, p99 %.0f us, max %.1f us; %llu deadlines missed, "
+               "%llu resyncs\n",
+            (unsigned long long) (pace->waits + pace->missed),
+            pace->late_total / 1e3 / pace->waits,
+            percentile(pace, 0.5), percentile(pace, 0.99), pace->late_max / 1e3,
+            (unsigned long long) pace->missed, (unsigned long long) pace->resyncs);
+}
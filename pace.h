@@ -0,0 +1,29 @@
+#ifndef _H_PACE_
+#define _H_PACE_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PACE_BUCKETS 1000  // Microseconds of lateness told apart
+
+// Frame pacing on absolute deadlines, measuring how late each wakeup is
+typedef struct {
+    long rate;        // Frames per second
+    uint64_t start;   // CLOCK_MONOTONIC ns of frame 0
+    uint64_t frame;   // Frames waited for since the start
+
+    uint64_t waits;
+    uint64_t missed;  // Deadlines that had already passed
+    uint64_t resyncs; // Times the clock was restarted after falling behind
+    uint64_t late_total;  // ns
+    uint64_t late_max;
+    uint32_t late[PACE_BUCKETS + 1];  // Histogram by microsecond, the last
+                                      // bucket for anything later
+} pace_t;
+
+void pace_init(pace_t *pace, long rate);
+void pace_set_rate(pace_t *pace, long rate);
+int pace_wait(pace_t *pace);
+void pace_report(const pace_t *pace, FILE *f);
+
+#endif
@@ -0,0 +1,279 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rewind.h"
+
+/*
+ * Rewind history
+ *
+ * A ring buffer of snapshots (see emu_save()), newest last. Every interval
+ * frames one is stored as a keyframe, and the ones in between as the XOR
+ * against their keyframe. Either way the bytes are run-length encoded as
+ *
+ *   uint16 zeros to skip, uint16 n, n literal bytes
+ *
+ * records, with trailing zeros left out. Consecutive frames differ in a few
+ * hundred bytes of RAM, so most records are a long skip and a short literal.
+ *
+ * When full, the oldest entries are dropped, along with the deltas whose
+ * keyframe went with them.
+ */
+
+#define MAX_ENTRIES (1 << 18)  // A bit over an hour at 60 frames per second
+#define NO_KEY UINT64_MAX
+
+typedef struct {
+    size_t offset;  // In data
+    size_t size;
+    uint64_t key;   // Sequence number of the keyframe, its own for keyframes
+} entry_t;
+
+struct rewind {
+    size_t state_size;
+    int interval;
+
+    uint8_t *data;
+    size_t capacity;
+    size_t write;  // Where the next entry goes
+
+    // Entries by sequence number, first to next - 1
+    entry_t *entries;
+    uint64_t first;
+    uint64_t next;
+
+    uint8_t *key;  // Decoded keyframe
+    uint64_t key_seq;
+
+    uint8_t *scratch;  // Encoder output
+};
+
+
+static entry_t *entry(const rewind_t *rw, uint64_t seq) {
+    return &rw->entries[seq % MAX_ENTRIES];
+}
+
+
+/*
+ * Encoding
+ */
+
+// Run-length encode state XOR base (zeros if base is NULL). Returns the size.
+static size_t encode(uint8_t *out, const uint8_t *state, const uint8_t *base, size_t size) {
+#define X(i) (state[i] ^ (base ? base[i] : 0))
+    size_t n = 0;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t skip = 0;
+        while (i < size && !X(i) && skip < 0xffff) {
+            skip++;
+            i++;
+        }
+
+        // Literals until four zeros in a row, a header costs that much
+        size_t start = i;
+        size_t len = 0;
+        while (i < size && len < 0xffff) {
+            if (!X(i) && (i + 3 >= size || (!X(i + 1) && !X(i + 2) && !X(i + 3)))) {
+                break;
+            }
+            len++;
+            i++;
+        }
+
+        if (!len && i == size) {
+            break;
+        }
+
+        out[n++] = skip;
+        out[n++] = skip >> 8;
+        out[n++] = len;
+        out[n++] = len >> 8;
+        for (size_t j = 0; j < len; j++) {
+            out[n++] = X(start + j);
+        }
+    }
+
+    return n;
+#undef X
+}
+
+
+static void decode(uint8_t *state, const uint8_t *base, const uint8_t *in, size_t n, size_t size) {
+    if (base) {
+        memcpy(state, base, size);
+    } else {
+        memset(state, 0, size);
+    }
+
+    size_t pos = 0;
+    const uint8_t *end = in + n;
+    while (in < end) {
+        pos += in[0] | in[1] << 8;
+        size_t len = in[2] | in[3] << 8;
+        in += 4;
+
+        for (size_t j = 0; j < len; j++) {
+            state[pos++] ^= *in++;
+        }
+    }
+}
+
+
+/*
+ * Ring buffer
+ */
+
+static void drop_oldest(rewind_t *rw) {
+    rw->first++;
+
+    // Deltas are useless without their keyframe
+    while (rw->first < rw->next && entry(rw, rw->first)->key < rw->first) {
+        rw->first++;
+    }
+}
+
+
+// Room for size contiguous bytes, dropping the oldest entries in the way
+static size_t alloc(rewind_t *rw, size_t size) {
+    if (rw->write + size > rw->capacity) {
+        rw->write = 0;
+    }
+
+    while (rw->first < rw->next) {
+        const entry_t *e = entry(rw, rw->first);
+        if (e->offset >= rw->write + size || e->offset + e->size <= rw->write) {
+            break;
+        }
+        drop_oldest(rw);
+    }
+
+    size_t offset = rw->write;
+    rw->write += size;
+    return offset;
+}
+
+
+// History of snapshots of state_size bytes in capacity bytes, with a
+// keyframe every interval frames
+rewind_t *rewind_new(size_t state_size, size_t capacity, int interval) {
+    // The worst case encoding is a header every 5 bytes
+    size_t worst = state_size + state_size / 5 * 4 + 8;
+    assert(capacity >= 4 * worst && interval > 0);
+
+    rewind_t *rw = calloc(1, sizeof(rewind_t));
+    rw->state_size = state_size;
+    rw->interval = interval;
+    rw->data = malloc(capacity);
+    rw->capacity = capacity;
+    rw->entries = malloc(MAX_ENTRIES * sizeof(entry_t));
+    rw->key = malloc(state_size);
+    rw->key_seq = NO_KEY;
+    rw->scratch = malloc(worst);
+
+    return rw;
+}
+
+
+void rewind_free(rewind_t *rw) {
+    free(rw->data);
+    free(rw->entries);
+    free(rw->key);
+    free(rw->scratch);
+    free(rw);
+}
+
+
+// Record the state of the frame that just ran
+void rewind_push(rewind_t *rw, const uint8_t *state) {
+    if (rw->next - rw->first == MAX_ENTRIES) {
+        drop_oldest(rw);
+    }
+
+    int keyframe = rw->key_seq == NO_KEY || rw->key_seq < rw->first ||
+                   rw->key_seq >= rw->next || rw->next - rw->key_seq >= rw->interval;
+
+    for (;;) {
+        size_t size = encode(rw->scratch, state, keyframe ? NULL : rw->key, rw->state_size);
+        size_t offset = alloc(rw, size);
+
+        // Making room may have dropped the keyframe this delta is against
+        if (!keyframe && rw->key_seq < rw->first) {
+            rw->write = offset;
+            keyframe = 1;
+            continue;
+        }
+
+        memcpy(rw->data + offset, rw->scratch, size);
+        if (keyframe) {
+            memcpy(rw->key, state, rw->state_size);
+            rw->key_seq = rw->next;
+        }
+        *entry(rw, rw->next) = (entry_t) { offset, size, rw->key_seq };
+        rw->next++;
+        return;
+    }
+}
+
+
+// Take the newest state out of the history. Returns 0 if it is empty.
+int rewind_pop(rewind_t *rw, uint8_t *state) {
+    if (rw->first == rw->next) {
+        return 0;
+    }
+
+    uint64_t seq = rw->next - 1;
+    const entry_t *e = entry(rw, seq);
+
+    if (e->key == seq) {
+        decode(state, NULL, rw->data + e->offset, e->size, rw->state_size);
+    } else {
+        if (rw->key_seq != e->key) {
+            const entry_t *k = entry(rw, e->key);
+            decode(rw->key, NULL, rw->data + k->offset, k->size, rw->state_size);
+            rw->key_seq = e->key;
+        }
+        decode(state, rw->key, rw->data + e->offset, e->size, rw->state_size);
+    }
+
+    rw->write = e->offset;
+    rw->next--;
+    return 1;
+}
+
+
+int rewind_frames(const rewind_t *rw) {
+    return rw->next - rw->first;
+}
+
+
+// Bytes of history, including the space lost at the wrap
+size_t rewind_used(const rewind_t *rw) {
+    if (rw->first == rw->next) {
+        return 0;
+    }
+
+    size_t oldest = entry(rw, rw->first)->offset;
+    return rw->write > oldest ? rw->write - oldest : rw->capacity - oldest + rw->write;
+}
+
+
+// Print the bytes a frame of history took on average, and how long the
+// whole buffer lasts at that rate, given frames per second
+void rewind_report(const rewind_t *rw, double rate, FILE *f) {
+    int frames = rewind_frames(rw);
+    if (!frames) {
+        return;
+    }
+
+    double per_frame = (double) rewind_used(rw) / frames;
+    double seconds = rw->capacity / per_frame / rate;
+    if (seconds > MAX_ENTRIES / rate) {
+        seconds = MAX_ENTRIES / rate;
+    }
+    fprintf(f, "Rewind: %d frames in %zu bytes, %.0f bytes/frame, room for %.0f minutes\n",
+            frames, rewind_used(rw), per_frame, seconds / 60);
+}
@@ -0,0 +1,18 @@
+#ifndef _H_REWIND_
+#define _H_REWIND_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct rewind rewind_t;
+
+rewind_t *rewind_new(size_t state_size, size_t capacity, int interval);
+void rewind_free(rewind_t *rw);
+void rewind_push(rewind_t *rw, const uint8_t *state);
+int rewind_pop(rewind_t *rw, uint8_t *state);
+int rewind_frames(const rewind_t *rw);
+size_t rewind_used(const rewind_t *rw);
+void rewind_report(const rewind_t *rw, double rate, FILE *f);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <assert.h>
+
+#include "sched.h"
+
+
+static int before(const event_t *a, const event_t *b) {
+    return a->when < b->when || (a->when == b->when && a->type < b->type);
+}
+
+static void swap(event_t *a, event_t *b) {
+    event_t t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void sift_up(sched_t *sched, int i) {
+    while (i > 0 && before(&sched->heap[i], &sched->heap[(i - 1) / 2])) {
+        swap(&sched->heap[i], &sched->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(sched_t *sched, int i) {
+    for (;;) {
+        int min = i;
+        int l = 2 * i + 1;
+        int r = 2 * i + 2;
+
+        if (l < sched->count && before(&sched->heap[l], &sched->heap[min])) {
+            min = l;
+        }
+        if (r < sched->count && before(&sched->heap[r], &sched->heap[min])) {
+            min = r;
+        }
+        if (min == i) {
+            return;
+        }
+
+        swap(&sched->heap[i], &sched->heap[min]);
+        i = min;
+    }
+}
+
+
+void sched_reset(sched_t *sched) {
+    sched->now = 0;
+    sched->count = 0;
+}
+
+
+void sched_add(sched_t *sched, uint64_t when, int type) {
+    assert(sched->count < SCHED_MAX_EVENTS);
+
+    sched->heap[sched->count] = (event_t) { when, type };
+    sift_up(sched, sched->count++);
+}
+
+
+// Drop every pending event of a type
+void sched_remove(sched_t *sched, int type) {
+    int n = 0;
+    for (int i = 0; i < sched->count; i++) {
+        if (sched->heap[i].type != type) {
+            sched->heap[n++] = sched->heap[i];
+        }
+    }
+    sched->count = n;
+
+    for (int i = n / 2 - 1; i >= 0; i--) {
+        sift_down(sched, i);
+    }
+}
+
+
+// Cycle the next event is due at, UINT64_MAX if there are none
+uint64_t sched_deadline(const sched_t *sched) {
+    return sched->count ? sched->heap[0].when : UINT64_MAX;
+}
+
+
+// Take the next event if it is due. Returns 0 if there is none.
+int sched_pop(sched_t *sched, event_t *event) {
+    if (!sched->count || sched->heap[0].when > sched->now) {
+        return 0;
+    }
+
+    *event = sched->heap[0];
+    sched->heap[0] = sched->heap[--sched->count];
+    sift_down(sched, 0);
+
+    return 1;
+}
@@ -0,0 +1,26 @@
+#ifndef _H_SCHED_
+#define _H_SCHED_
+
+#include <stdint.h>
+
+#define SCHED_MAX_EVENTS 16
+
+typedef struct {
+    uint64_t when;  // Master cycle the event is due at
+    int type;       // What it is, up to the owner. Lower types go first on ties.
+} event_t;
+
+// Min-heap of timed events on a 64-bit master cycle counter
+typedef struct {
+    uint64_t now;
+    event_t heap[SCHED_MAX_EVENTS];
+    int count;
+} sched_t;
+
+void sched_reset(sched_t *sched);
+void sched_add(sched_t *sched, uint64_t when, int type);
+void sched_remove(sched_t *sched, int type);
+uint64_t sched_deadline(const sched_t *sched);
+int sched_pop(sched_t *sched, event_t *event);
+
+#endif
@@ -0,0 +1,120 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "trace.h"
+
+/*
+ * Binary instruction trace
+ *
+ * The emulating thread fills a single-producer single-consumer ring of
+ * records, and a writer thread drains it to the file in large chunks. The
+ * two only share the head and tail counters, published with release stores
+ * and read with acquire loads, so adding a record is a copy and a store.
+ * When the ring is full the producer waits for the writer instead of losing
+ * records.
+ */
+
+#define RING_SIZE (1 << 16)  // Records, a power of two
+#define IDLE_NS 1000000      // Writer sleep when the ring is empty
+
+struct trace {
+    FILE *f;
+    pthread_t writer;
+
+    trace_record_t ring[RING_SIZE];
+    uint64_t head;  // Next record to add, owned by the producer
+    uint64_t tail;  // Next record to write, owned by the writer
+    int stop;
+};
+
+
+static void *trace_writer(void *arg) {
+    trace_t *trace = arg;
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = trace->tail;
+
+        if (head == tail) {
+            if (__atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE)) {
+                // Records added before stop was set are visible by now
+                if (__atomic_load_n(&trace->head, __ATOMIC_ACQUIRE) == tail) {
+                    return NULL;
+                }
+                continue;
+            }
+
+            struct timespec idle = { 0, IDLE_NS };
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        // Up to the end of the ring, the rest goes on the next round
+        uint64_t start = tail % RING_SIZE;
+        uint64_t n = head - tail;
+        if (n > RING_SIZE - start) {
+            n = RING_SIZE - start;
+        }
+
+        fwrite(&trace->ring[start], sizeof(trace_record_t), n, trace->f);
+        __atomic_store_n(&trace->tail, tail + n, __ATOMIC_RELEASE);
+    }
+}
+
+
+// Start tracing into a file. Returns NULL if it cannot be created.
+trace_t *trace_open(const char *file_name) {
+    FILE *f = fopen(file_name, "wb");
+    if (!f) {
+        return NULL;
+    }
+    fwrite(TRACE_MAGIC, 8, 1, f);
+
+    trace_t *trace = calloc(1, sizeof(trace_t));
+    trace->f = f;
+    pthread_create(&trace->writer, NULL, trace_writer, trace);
+
+    return trace;
+}
+
+
+// Write out everything still in the ring and close the file
+void trace_close(trace_t *trace) {
+    __atomic_store_n(&trace->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(trace->writer, NULL);
+
+    fclose(trace->f);
+    free(trace);
+}
+
+
+// Record the instruction the CPU is about to run
+void trace_add(trace_t *trace, uint64_t cycle, const struct cpu *cpu) {
+    uint64_t head = trace->head;
+
+    while (head - __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+        sched_yield();  // Full, let the writer catch up
+    }
+
+    trace_record_t *r = &trace->ring[head % RING_SIZE];
+    r->cycle = cycle;
+    r->pc = cpu->pc;
+    r->sp = cpu->sp;
+    r->bc = cpu->bc;
+    r->de = cpu->de;
+    r->hl = cpu->hl;
+    r->a = cpu->a;
+    r->f = cpu->f;
+    r->code[0] = mem_read(cpu->mem, cpu->pc);
+    r->code[1] = mem_read(cpu->mem, cpu->pc + 1);
+    r->code[2] = mem_read(cpu->mem, cpu->pc + 2);
+    r->pad = 0;
+
+    __atomic_store_n(&trace->head, head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,31 @@
+#ifndef _H_TRACE_
+#define _H_TRACE_
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define TRACE_MAGIC "INVTRACE"
+
+// One executed instruction, as the CPU was right before running it. Trace
+// files are TRACE_MAGIC followed by these records, in host byte order.
+typedef struct {
+    uint64_t cycle;  // Master cycle
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t bc;
+    uint16_t de;
+    uint16_t hl;
+    uint8_t a;
+    uint8_t f;
+    uint8_t code[3];  // Opcode and operands
+    uint8_t pad;
+} trace_record_t;
+
+typedef struct trace trace_t;
+
+trace_t *trace_open(const char *file_name);
+void trace_close(trace_t *trace);
+void trace_add(trace_t *trace, uint64_t cycle, const struct cpu *cpu);
+
+#endif
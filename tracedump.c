@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+#include "disassembler.h"
+
+#define CHUNK 4096  // Records read at a time
+
+
+// Print a binary trace (see trace.c) as one line per instruction
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("Usage: %s trace\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        printf("Could not open trace: %s\n", argv[1]);
+        return 1;
+    }
+
+    char magic[8];
+    if (fread(magic, 8, 1, f) != 1 || memcmp(magic, TRACE_MAGIC, 8)) {
+        printf("Not a trace: %s\n", argv[1]);
+        return 1;
+    }
+
+    static trace_record_t records[CHUNK];
+    size_t n;
+    while ((n = fread(records, sizeof(trace_record_t), CHUNK, f)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            const trace_record_t *r = &records[i];
+
+            printf("%12llu  %04x  A: %02x  F: %02x  BC: %04x  DE: %04x  HL: %04x  SP: %04x  ",
+                    (unsigned long long) r->cycle, r->pc,
+                    r->a, r->f, r->bc, r->de, r->hl, r->sp);
+            char text[DISASM_SIZE];
+            disasm(r->code, text, sizeof text, NULL);
+            puts(text);
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
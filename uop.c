@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uop.h"
+
+/*
+ * Predecoded instruction cache
+ *
+ * Every address that has been executed gets a record with the handler, the
+ * length and the operands of the instruction that starts there, so running it
+ * again is a single lookup instead of up to three mem_read() calls plus the
+ * length decode in cpu_fetch(). Cycle counts still come from the handlers,
+ * since conditional calls and returns take a different number of cycles
+ * depending on the flags.
+ *
+ * Decoded bytes are registered with the memory write watch. A write into one
+ * clears the records of the (up to three) instructions that could contain it,
+ * and they are decoded again the next time they run.
+ */
+
+typedef struct {
+    cpu_handler_t handler;  // NULL when not decoded
+    uint16_t operands;      // Loaded into WZ
+    uint8_t op;
+    uint8_t length;
+} uop_t;
+
+struct uop_cache {
+    struct cpu *cpu;
+    uop_t uops[0x10000];
+};
+
+
+// Called by mem_write() after a write to decoded bytes
+static void uop_code_write(void *ctx, uint16_t addr) {
+    uop_cache_t *cache = ctx;
+
+    for (int i = 0; i < 3; i++) {
+        uop_t *u = &cache->uops[(uint16_t) (addr - i)];
+        if (u->length > i) {
+            u->handler = NULL;
+        }
+    }
+}
+
+
+static uop_t *uop_decode(uop_cache_t *cache, uint16_t pc) {
+    mem_t *mem = cache->cpu->mem;
+    uop_t *u = &cache->uops[pc];
+
+    u->op = mem_read(mem, pc);
+    u->handler = cpu_handler(u->op);
+    u->length = cpu_length(u->op);
+    u->operands = mem_read(mem, pc + 1) | mem_read(mem, pc + 2) << 8;
+
+    for (int i = 0; i < u->length; i++) {
+        mem_watch(mem, pc + i);
+    }
+
+    return u;
+}
+
+
+uop_cache_t *uop_new(struct cpu *cpu) {
+    uop_cache_t *cache = calloc(1, sizeof(uop_cache_t));
+    cache->cpu = cpu;
+
+    mem_set_watch(cpu->mem, uop_code_write, cache);
+
+    return cache;
+}
+
+
+void uop_free(uop_cache_t *cache) {
+    mem_set_watch(cache->cpu->mem, NULL, NULL);
+    free(cache);
+}
+
+
+// Same contract as cpu_run()
+long uop_run(uop_cache_t *cache, long cycles) {
+    struct cpu *cpu = cache->cpu;
+
+    long i = 0;
+    while (i < cycles) {
+        uop_t *u = &cache->uops[cpu->pc];
+        if (!u->handler) {
+            u = uop_decode(cache, cpu->pc);
+            if (!u->handler) {
+                cpu_fetch(cpu);  // Leave IR and PC as the interpreter would
+                return -1;
+            }
+        }
+
+        cpu->ir = u->op;
+        if (u->length == 2) {
+            cpu->z = u->operands;
+        } else if (u->length == 3) {
+            cpu->wz = u->operands;
+        }
+        cpu->pc += u->length;
+        cpu->instructions++;
+
+        i += u->handler(cpu);
+    }
+
+    return i;
+}
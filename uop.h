@@ -0,0 +1,12 @@
+#ifndef _H_UOP_
+#define _H_UOP_
+
+#include "cpu.h"
+
+typedef struct uop_cache uop_cache_t;
+
+uop_cache_t *uop_new(struct cpu *cpu);
+void uop_free(uop_cache_t *cache);
+long uop_run(uop_cache_t *cache, long cycles);
+
+#endif
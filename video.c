@@ -0,0 +1,307 @@
+#include <stdint.h>
+#include <assert.h>
+
+#include "emu.h"
+#include "video.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * 1 bpp to 32 bpp expansion
+ *
+ * The monitor is mounted rotated, so video RAM holds the picture column by
+ * column: byte k of column x has the pixels at rows 255 - 8k down to
+ * 248 - 8k, least significant bit lowest. Writing it out row-major is a
+ * transpose of a 224 x 32 byte matrix followed by a bit expansion.
+ *
+ * The SIMD versions transpose 16 x 16 byte blocks in registers (16 columns,
+ * 16 bytes of each) so every transposed row holds one byte of 16 adjacent
+ * columns, then turn each bit plane of it into 16 pixels with a compare.
+ */
+
+#define COLUMN_BYTES (HEIGHT / 8)
+
+
+// Expand the byte at offset from VRAM_START
+void video_expand_byte(uint32_t *pix, int pitch, int offset, uint8_t byte) {
+    int col = offset / COLUMN_BYTES;
+    int row = HEIGHT - 1 - offset % COLUMN_BYTES * 8;
+
+    for (int j = 0; j < 8; j++) {
+        pix[(row - j) * pitch + col] = byte & 1 << j ? VIDEO_WHITE : VIDEO_BLACK;
+    }
+}
+
+
+static void expand_scalar(const uint8_t *vram, uint32_t *pix, int pitch) {
+    for (int i = 0; i < VRAM_END - VRAM_START; i++) {
+        video_expand_byte(pix, pitch, i, vram[i]);
+    }
+}
+
+
+#if defined(__x86_64__)
+
+// In-register transpose of 16 rows of 16 bytes. Always inlined, so the AVX2
+// expander does not call into legacy SSE code and pay for the transitions.
+__attribute__((always_inline))
+static inline void transpose16(__m128i r[16]) {
+    __m128i t[16];
+
+    for (int i = 0; i < 8; i++) {
+        t[i] = _mm_unpacklo_epi8(r[2*i], r[2*i + 1]);
+        t[i + 8] = _mm_unpackhi_epi8(r[2*i], r[2*i + 1]);
+    }
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_unpacklo_epi16(t[2*i], t[2*i + 1]);
+        r[i + 8] = _mm_unpackhi_epi16(t[2*i], t[2*i + 1]);
+    }
+    for (int i = 0; i < 8; i++) {
+        t[i] = _mm_unpacklo_epi32(r[2*i], r[2*i + 1]);
+        t[i + 8] = _mm_unpackhi_epi32(r[2*i], r[2*i + 1]);
+    }
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_unpacklo_epi64(t[2*i], t[2*i + 1]);
+        r[i + 8] = _mm_unpackhi_epi64(t[2*i], t[2*i + 1]);
+    }
+}
+
+// Load 16 columns from col, 16 bytes each from byte k, one column a row.
+// The unpack network above leaves row n of the transpose in r[bitrev(n)].
+__attribute__((always_inline))
+static inline void load_block(const uint8_t *vram, int col, int k, __m128i out[16]) {
+    static const int bitrev[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+    __m128i r[16];
+
+    for (int i = 0; i < 16; i++) {
+        r[i] = _mm_loadu_si128((const __m128i *) &vram[(col + i) * COLUMN_BYTES + k]);
+    }
+    transpose16(r);
+    for (int i = 0; i < 16; i++) {
+        out[i] = r[bitrev[i]];
+    }
+}
+
+static void expand_sse2(const uint8_t *vram, uint32_t *pix, int pitch) {
+    const __m128i white = _mm_set1_epi32(VIDEO_WHITE);
+
+    for (int col = 0; col < WIDTH; col += 16) {
+        for (int k = 0; k < COLUMN_BYTES; k += 16) {
+            __m128i rows[16];
+            load_block(vram, col, k, rows);
+
+            for (int n = 0; n < 16; n++) {
+                for (int j = 0; j < 8; j++) {
+                    const __m128i bit = _mm_set1_epi8((char) (1 << j));
+                    __m128i m = _mm_cmpeq_epi8(_mm_and_si128(rows[n], bit), bit);
+                    __m128i lo = _mm_unpacklo_epi8(m, m);
+                    __m128i hi = _mm_unpackhi_epi8(m, m);
+
+                    __m128i *dst = (__m128i *) &pix[(HEIGHT - 1 - (k + n) * 8 - j) * pitch + col];
+                    _mm_storeu_si128(dst + 0, _mm_and_si128(_mm_unpacklo_epi16(lo, lo), white));
+                    _mm_storeu_si128(dst + 1, _mm_and_si128(_mm_unpackhi_epi16(lo, lo), white));
+                    _mm_storeu_si128(dst + 2, _mm_and_si128(_mm_unpacklo_epi16(hi, hi), white));
+                    _mm_storeu_si128(dst + 3, _mm_and_si128(_mm_unpackhi_epi16(hi, hi), white));
+                }
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(const uint8_t *vram, uint32_t *pix, int pitch) {
+    const __m256i white = _mm256_set1_epi32(VIDEO_WHITE);
+
+    for (int col = 0; col < WIDTH; col += 16) {
+        for (int k = 0; k < COLUMN_BYTES; k += 16) {
+            __m128i rows[16];
+            load_block(vram, col, k, rows);
+
+            for (int n = 0; n < 16; n++) {
+                for (int j = 0; j < 8; j++) {
+                    // Compare a bit plane of 16 columns, widen the mask to 32-bit lanes
+                    const __m128i bit = _mm_set1_epi8((char) (1 << j));
+                    __m128i m = _mm_cmpeq_epi8(_mm_and_si128(rows[n], bit), bit);
+
+                    __m256i *dst = (__m256i *) &pix[(HEIGHT - 1 - (k + n) * 8 - j) * pitch + col];
+                    _mm256_storeu_si256(dst + 0, _mm256_and_si256(_mm256_cvtepi8_epi32(m), white));
+                    _mm256_storeu_si256(dst + 1,
+                            _mm256_and_si256(_mm256_cvtepi8_epi32(_mm_srli_si128(m, 8)), white));
+                }
+            }
+        }
+    }
+}
+
+#endif
+
+
+/*
+ * Upscaling
+ *
+ * Each output row is one source row repeated scale times, masked with a
+ * colour of its own. Expanded pixels are all ones or all zeros, so the mask
+ * is the colour lit pixels get: the cellophane band the row sits under on
+ * the cabinet, darkened on the last row of each scaled line for scanlines.
+ */
+
+// Cellophane bands of the cabinet, by upright row: red over the saucer,
+// green over the shields and the player
+static uint32_t band(int row) {
+    if (row >= 32 && row < 64) {
+        return VIDEO_RED;
+    }
+    if (row >= 184 && row < 240) {
+        return VIDEO_GREEN;
+    }
+    return VIDEO_WHITE;
+}
+
+// Fill the HEIGHT * scale row masks
+void video_row_masks(uint32_t *mask, int scale, int color, int scanlines) {
+    for (int y = 0; y < HEIGHT * scale; y++) {
+        mask[y] = color ? band(y / scale) : VIDEO_WHITE;
+        if (scanlines && scale > 1 && y % scale == scale - 1) {
+            mask[y] = mask[y] >> 1 & 0x7F7F7F;
+        }
+    }
+}
+
+
+static void upscale_scalar(const uint32_t *pix, uint32_t *out, int pitch,
+                           int scale, const uint32_t *mask, int rows) {
+    for (int y = 0; y < rows * scale; y++) {
+        const uint32_t *src = &pix[y / scale * WIDTH];
+        uint32_t *dst = &out[y * pitch];
+
+        for (int x = 0; x < WIDTH; x++) {
+            for (int i = 0; i < scale; i++) {
+                *dst++ = src[x] & mask[y];
+            }
+        }
+    }
+}
+
+
+#if defined(__x86_64__)
+
+// Four source pixels at a time, each spread over scale lanes with shuffles
+static void upscale_sse2(const uint32_t *pix, uint32_t *out, int pitch,
+                         int scale, const uint32_t *mask, int rows) {
+    for (int y = 0; y < rows * scale; y++) {
+        const __m128i *src = (const __m128i *) &pix[y / scale * WIDTH];
+        __m128i *dst = (__m128i *) &out[y * pitch];
+        const __m128i m = _mm_set1_epi32(mask[y]);
+
+        for (int x = 0; x < WIDTH / 4; x++) {
+            __m128i v = _mm_and_si128(_mm_loadu_si128(&src[x]), m);
+
+            switch (scale) {
+                case 1:
+                    _mm_storeu_si128(dst++, v);
+                    break;
+                case 2:
+                    _mm_storeu_si128(dst++, _mm_unpacklo_epi32(v, v));
+                    _mm_storeu_si128(dst++, _mm_unpackhi_epi32(v, v));
+                    break;
+                case 3:
+                    _mm_storeu_si128(dst++, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+                    _mm_storeu_si128(dst++, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+                    _mm_storeu_si128(dst++, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+                    break;
+                case 4:
+                    _mm_storeu_si128(dst++, _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+                    _mm_storeu_si128(dst++, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+                    _mm_storeu_si128(dst++, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+                    _mm_storeu_si128(dst++, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+                    break;
+            }
+        }
+    }
+}
+
+#endif
+
+
+/*
+ * Selection
+ *
+ * What the host supports is only checked in video_init(), before any other
+ * thread can use the tables.
+ */
+
+static video_expander_t expanders[3];
+static int expander_count;
+
+static video_upscaler_t upscalers[2];
+static int upscaler_count;
+
+
+// Find the expanders and upscalers this host can run. Call once, before
+// anything else in here and before starting threads that use them.
+void video_init() {
+    expander_count = 0;
+    expanders[expander_count++] = (video_expander_t) { "scalar", expand_scalar };
+#if defined(__x86_64__)
+    expanders[expander_count++] = (video_expander_t) { "sse2", expand_sse2 };
+    if (__builtin_cpu_supports("avx2")) {
+        expanders[expander_count++] = (video_expander_t) { "avx2", expand_avx2 };
+    }
+#endif
+
+    upscaler_count = 0;
+    upscalers[upscaler_count++] = (video_upscaler_t) { "scalar", upscale_scalar };
+#if defined(__x86_64__)
+    upscalers[upscaler_count++] = (video_upscaler_t) { "sse2", upscale_sse2 };
+#endif
+}
+
+
+// Usable expanders on this host, fastest last
+const video_expander_t *video_expanders(int *n) {
+    assert(expander_count);
+    *n = expander_count;
+    return expanders;
+}
+
+// Usable upscalers on this host, fastest last
+const video_upscaler_t *video_upscalers(int *n) {
+    assert(upscaler_count);
+    *n = upscaler_count;
+    return upscalers;
+}
+
+
+// Expand the whole frame with the fastest expander
+void video_expand(const uint8_t *vram, uint32_t *pix, int pitch) {
+    assert(expander_count);
+    expanders[expander_count - 1].expand(vram, pix, pitch);
+}
+
+// Expand rows [top, bottom), both multiples of 8. Small ranges go byte by
+// byte, which beats a SIMD pass over the whole frame; larger ones take that
+// pass, so the other rows may be expanded again too.
+void video_expand_rows(const uint8_t *vram, uint32_t *pix, int pitch, int top, int bottom) {
+    assert(top % 8 == 0 && bottom % 8 == 0 && top <= bottom && bottom <= HEIGHT);
+
+    if (bottom - top > HEIGHT / 4) {
+        video_expand(vram, pix, pitch);
+        return;
+    }
+
+    for (int k = (HEIGHT - bottom) / 8; k < (HEIGHT - top) / 8; k++) {
+        for (int col = 0; col < WIDTH; col++) {
+            int offset = col * COLUMN_BYTES + k;
+            video_expand_byte(pix, pitch, offset, vram[offset]);
+        }
+    }
+}
+
+// Upscale with the fastest upscaler
+void video_upscale(const uint32_t *pix, uint32_t *out, int pitch, int scale,
+                   const uint32_t *mask, int rows) {
+    assert(upscaler_count);
+    upscalers[upscaler_count - 1].upscale(pix, out, pitch, scale, mask, rows);
+}
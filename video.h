@@ -0,0 +1,45 @@
+#ifndef _H_VIDEO_
+#define _H_VIDEO_
+
+#include <stdint.h>
+
+#define VIDEO_WHITE 0xFFFFFF
+#define VIDEO_BLACK 0x000000
+#define VIDEO_RED   0xFF2020
+#define VIDEO_GREEN 0x20FF20
+
+#define VIDEO_MAX_SCALE 4
+
+// Expand the 1 bpp video RAM (VRAM_START to VRAM_END, one column of 32
+// bytes after another, bottom to top) into upright WIDTH x HEIGHT pixels,
+// rows pitch pixels apart
+typedef void (*video_expand_t)(const uint8_t *vram, uint32_t *pix, int pitch);
+
+typedef struct {
+    const char *name;
+    video_expand_t expand;
+} video_expander_t;
+
+void video_init();
+void video_expand_byte(uint32_t *pix, int pitch, int offset, uint8_t byte);
+void video_expand(const uint8_t *vram, uint32_t *pix, int pitch);
+void video_expand_rows(const uint8_t *vram, uint32_t *pix, int pitch, int top, int bottom);
+const video_expander_t *video_expanders(int *n);
+
+// Scale rows of expanded pixels, HEIGHT for a whole frame, up by scale (1 to
+// VIDEO_MAX_SCALE) into rows pitch pixels apart, ANDing output row y with
+// mask[y]
+typedef void (*video_upscale_t)(const uint32_t *pix, uint32_t *out, int pitch,
+                                int scale, const uint32_t *mask, int rows);
+
+typedef struct {
+    const char *name;
+    video_upscale_t upscale;
+} video_upscaler_t;
+
+void video_row_masks(uint32_t *mask, int scale, int color, int scanlines);
+void video_upscale(const uint32_t *pix, uint32_t *out, int pitch, int scale,
+                   const uint32_t *mask, int rows);
+const video_upscaler_t *video_upscalers(int *n);
+
+#endif